@@ -0,0 +1,627 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gmp.h>
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: make bench, speed of pp and golden digests of its output
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+typedef uint8_t  u8;
+typedef uint64_t u64;
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+
+#define WORD_LEN_MAX   24
+#define NAME_MAX_LEN   64
+#define GOLDS_MAX      1024
+#define READ_BUF_SIZE  0x100000
+
+// candidates for the candidates/s run and per digest range
+
+#define SPEED_CANDS    100000000
+#define DIGEST_CANDS   1000000
+
+#define DIGEST_MUL     0x100000001b3ull
+
+/**
+ * Wordlists are made up from a length distribution and a fixed seed, so the
+ * same name gives the same wordlist everywhere
+ */
+
+typedef struct
+{
+  const char *name;
+
+  u64 dist[WORD_LEN_MAX + 1];
+
+} bench_dist_t;
+
+static const bench_dist_t BENCH_DISTS[] =
+{
+  // the first 1,000,000 entries of rockyou.txt, like DEF_WORDLEN_DIST in engine.c
+
+  { "rockyou", { 0, 15, 56, 350, 3315, 43721, 276252, 201748, 226412, 119885, 75075, 26323, 13373, 6353, 3540, 1877, 972, 311, 151, 81, 66, 21, 16, 13, 13 } },
+
+  // every length pp takes equally often
+
+  { "flat",    { 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 } },
+
+  // mostly short words, many chains per length
+
+  { "short",   { 0, 10, 40, 160, 320, 160, 40, 10 } },
+};
+
+#define BENCH_DISTS_CNT (int) (sizeof (BENCH_DISTS) / sizeof (bench_dist_t))
+
+static const char CHARS_SPECIAL[] = "!@#$%&*._-";
+
+typedef struct
+{
+  char key[NAME_MAX_LEN * 3];
+  char digest[17];
+
+} gold_t;
+
+typedef struct
+{
+  gold_t buf[GOLDS_MAX];
+  int    cnt;
+
+  int    changed;
+
+} golds_t;
+
+typedef struct
+{
+  double t_first;
+  double t_end;
+
+  u64    bytes;
+  u64    digest;
+
+  char   head[256];
+  u64    head_len;
+
+  int    failed;
+
+} run_t;
+
+static const char *USAGE[] =
+{
+  "Usage: %s [--update] pp-binary golden-file wordlist-dir dist-words...",
+  "",
+  "  dist-words   wordlist to run on, e.g. rockyou-10000, made up in wordlist-dir if missing",
+  "               distributions: rockyou, flat, short",
+  "  --update     record the digests in golden-file instead of checking them",
+  NULL
+};
+
+static void usage (const char *progname)
+{
+  for (int i = 0; USAGE[i] != NULL; i++)
+  {
+    printf (USAGE[i], progname);
+
+    fputc ('\n', stdout);
+  }
+}
+
+static double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static u64 rand_next (u64 *state)
+{
+  // xorshift64*
+
+  u64 x = *state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+
+  *state = x;
+
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+static u64 name_hash (const char *name)
+{
+  u64 hash = 0xcbf29ce484222325ull;
+
+  for (const char *p = name; *p; p++)
+  {
+    hash ^= (u8) *p;
+    hash *= DIGEST_MUL;
+  }
+
+  return hash;
+}
+
+/**
+ * wordlists
+ */
+
+static const bench_dist_t *dist_parse (const char *spec, u64 *words_cnt)
+{
+  const char *sep = strrchr (spec, '-');
+
+  if (sep == NULL) return NULL;
+
+  char *end;
+
+  *words_cnt = strtoull (sep + 1, &end, 10);
+
+  if ((*end != 0) || (*words_cnt == 0)) return NULL;
+
+  for (int dists_idx = 0; dists_idx < BENCH_DISTS_CNT; dists_idx++)
+  {
+    const bench_dist_t *dist = &BENCH_DISTS[dists_idx];
+
+    if (strlen (dist->name) != (size_t) (sep - spec)) continue;
+
+    if (memcmp (dist->name, spec, sep - spec) == 0) return dist;
+  }
+
+  return NULL;
+}
+
+static int wl_make (const char *file, const bench_dist_t *dist, const u64 words_cnt, const char *spec)
+{
+  struct stat s;
+
+  if ((stat (file, &s) == 0) && (s.st_size > 0)) return 0;
+
+  char *tmp_file;
+
+  if (asprintf (&tmp_file, "%s.tmp", file) == -1) return -1;
+
+  FILE *fp = fopen (tmp_file, "wb");
+
+  if (fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", tmp_file, strerror (errno));
+
+    free (tmp_file);
+
+    return -1;
+  }
+
+  u64 dist_sum = 0;
+
+  for (int len = 1; len <= WORD_LEN_MAX; len++) dist_sum += dist->dist[len];
+
+  u64 state = name_hash (spec) | 1;
+
+  char word[WORD_LEN_MAX + 1];
+
+  for (u64 words_idx = 0; words_idx < words_cnt; words_idx++)
+  {
+    u64 pick = rand_next (&state) % dist_sum;
+
+    int len = 1;
+
+    while (pick >= dist->dist[len])
+    {
+      pick -= dist->dist[len];
+
+      len++;
+    }
+
+    for (int pos = 0; pos < len; pos++)
+    {
+      const u64 r = rand_next (&state);
+
+      const u64 cls = r % 100;
+
+      if      (cls < 80) word[pos] = 'a' + (r >> 8) % 26;
+      else if (cls < 90) word[pos] = '0' + (r >> 8) % 10;
+      else if (cls < 96) word[pos] = 'A' + (r >> 8) % 26;
+      else               word[pos] = CHARS_SPECIAL[(r >> 8) % (sizeof (CHARS_SPECIAL) - 1)];
+    }
+
+    word[len] = '\n';
+
+    fwrite (word, len + 1, 1, fp);
+  }
+
+  if (fclose (fp) != 0)
+  {
+    fprintf (stderr, "%s: %s\n", tmp_file, strerror (errno));
+
+    free (tmp_file);
+
+    return -1;
+  }
+
+  const int rc = rename (tmp_file, file);
+
+  free (tmp_file);
+
+  return rc;
+}
+
+/**
+ * runs pp on a wordlist, times the first byte and the end of its output and
+ * takes the digest of the output, which is a polynomial rolling hash so the
+ * digests of two ranges can be combined into the digest of both
+ */
+
+static void pp_run (const char *pp, const char *wl_file, const char *arg1, const char *arg2, const int digest, run_t *run)
+{
+  memset (run, 0, sizeof (run_t));
+
+  run->failed = 1;
+
+  int fds[2];
+
+  if (pipe (fds) == -1) return;
+
+  const double t_beg = now ();
+
+  const pid_t pid = fork ();
+
+  if (pid == -1) return;
+
+  if (pid == 0)
+  {
+    const int fd = open (wl_file, O_RDONLY);
+
+    if (fd == -1) _exit (127);
+
+    dup2 (fd, 0);
+    dup2 (fds[1], 1);
+
+    close (fd);
+    close (fds[0]);
+    close (fds[1]);
+
+    execl (pp, pp, arg1, arg2, (char *) NULL);
+
+    _exit (127);
+  }
+
+  close (fds[1]);
+
+  u8 *buf = (u8 *) malloc (READ_BUF_SIZE);
+
+  u64 hash = 0;
+
+  ssize_t nread;
+
+  while ((nread = read (fds[0], buf, READ_BUF_SIZE)) > 0)
+  {
+    if (run->bytes == 0) run->t_first = now () - t_beg;
+
+    if (run->head_len < sizeof (run->head) - 1)
+    {
+      const u64 copy = MIN ((u64) nread, sizeof (run->head) - 1 - run->head_len);
+
+      memcpy (run->head + run->head_len, buf, copy);
+
+      run->head_len += copy;
+    }
+
+    if (digest)
+    {
+      for (ssize_t pos = 0; pos < nread; pos++) hash = hash * DIGEST_MUL + buf[pos];
+    }
+
+    run->bytes += nread;
+  }
+
+  free (buf);
+
+  close (fds[0]);
+
+  int status;
+
+  waitpid (pid, &status, 0);
+
+  run->t_end  = now () - t_beg;
+  run->digest = hash;
+
+  run->failed = !(WIFEXITED (status) && (WEXITSTATUS (status) == 0));
+}
+
+/**
+ * golden digests, one "dist-words skip limit digest" per line
+ */
+
+static int golds_load (const char *file, golds_t *golds)
+{
+  golds->cnt     = 0;
+  golds->changed = 0;
+
+  FILE *fp = fopen (file, "rb");
+
+  if (fp == NULL) return 0;
+
+  char line[512];
+
+  while (fgets (line, sizeof (line), fp))
+  {
+    if ((line[0] == '#') || (line[0] == '\n')) continue;
+
+    if (golds->cnt == GOLDS_MAX) break;
+
+    char name[NAME_MAX_LEN], skip[NAME_MAX_LEN], limit[NAME_MAX_LEN], digest[17];
+
+    if (sscanf (line, "%63s %63s %63s %16s", name, skip, limit, digest) != 4) continue;
+
+    gold_t *gold = &golds->buf[golds->cnt++];
+
+    snprintf (gold->key, sizeof (gold->key), "%s %s %s", name, skip, limit);
+
+    strcpy (gold->digest, digest);
+  }
+
+  fclose (fp);
+
+  return 0;
+}
+
+static int golds_write (const char *file, const golds_t *golds)
+{
+  FILE *fp = fopen (file, "wb");
+
+  if (fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", file, strerror (errno));
+
+    return -1;
+  }
+
+  fprintf (fp, "# golden digests for make bench, wordlist skip limit digest\n");
+
+  for (int golds_idx = 0; golds_idx < golds->cnt; golds_idx++)
+  {
+    fprintf (fp, "%s %s\n", golds->buf[golds_idx].key, golds->buf[golds_idx].digest);
+  }
+
+  fclose (fp);
+
+  return 0;
+}
+
+static gold_t *gold_find (golds_t *golds, const char *key)
+{
+  for (int golds_idx = 0; golds_idx < golds->cnt; golds_idx++)
+  {
+    if (strcmp (golds->buf[golds_idx].key, key) == 0) return &golds->buf[golds_idx];
+  }
+
+  return NULL;
+}
+
+// returns 0 for a match or a new digest recorded, 1 for no golden digest and -1 for a mismatch
+
+static int gold_check (golds_t *golds, const char *key, const u64 digest, const int update)
+{
+  char digest_buf[17];
+
+  snprintf (digest_buf, sizeof (digest_buf), "%016llx", (unsigned long long) digest);
+
+  gold_t *gold = gold_find (golds, key);
+
+  if (update)
+  {
+    if (gold == NULL)
+    {
+      if (golds->cnt == GOLDS_MAX) return -1;
+
+      gold = &golds->buf[golds->cnt++];
+
+      strcpy (gold->key, key);
+    }
+
+    if (strcmp (gold->digest, digest_buf)) golds->changed = 1;
+
+    strcpy (gold->digest, digest_buf);
+
+    return 0;
+  }
+
+  if (gold == NULL) return 1;
+
+  if (strcmp (gold->digest, digest_buf))
+  {
+    fprintf (stderr, "Digest mismatch for %s: %s, expected %s\n", key, digest_buf, gold->digest);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * the bench of one wordlist
+ */
+
+static int bench_wordlist (const char *pp, const char *wl_dir, const char *spec, golds_t *golds, const int update)
+{
+  u64 words_cnt;
+
+  const bench_dist_t *dist = dist_parse (spec, &words_cnt);
+
+  if (dist == NULL)
+  {
+    fprintf (stderr, "%s: unknown wordlist, use dist-words like rockyou-10000\n", spec);
+
+    return -1;
+  }
+
+  char wl_file[4096];
+
+  snprintf (wl_file, sizeof (wl_file), "%s/%s.txt", wl_dir, spec);
+
+  if (wl_make (wl_file, dist, words_cnt, spec) == -1) return -1;
+
+  run_t run;
+
+  // keyspace
+
+  pp_run (pp, wl_file, "--keyspace", NULL, 0, &run);
+
+  if (run.failed)
+  {
+    fprintf (stderr, "%s: pp --keyspace failed\n", spec);
+
+    return -1;
+  }
+
+  const double t_keyspace = run.t_end;
+
+  mpz_t ks_cnt; mpz_init (ks_cnt);
+  mpz_t skip;   mpz_init (skip);
+  mpz_t limit;  mpz_init (limit);
+
+  run.head[run.head_len] = 0;
+
+  gmp_sscanf (run.head, "%Zd", ks_cnt);
+
+  // steady state, from the first candidate on
+
+  mpz_set_ui (limit, SPEED_CANDS);
+
+  if (mpz_cmp (limit, ks_cnt) > 0) mpz_set (limit, ks_cnt);
+
+  char arg1[NAME_MAX_LEN + 16];
+  char arg2[NAME_MAX_LEN + 16];
+
+  gmp_snprintf (arg1, sizeof (arg1), "--limit=%Zd", limit);
+
+  pp_run (pp, wl_file, arg1, NULL, 0, &run);
+
+  const double t_startup = run.t_first;
+
+  const double cands_per_sec = mpz_get_d (limit) / (run.t_end - run.t_first);
+
+  int rc = (run.failed) ? -1 : 0;
+
+  // digests at the start, in the middle and deep into the keyspace, the last one times the seek
+
+  static const int DIGEST_FRACS[3][2] = { { 0, 1 }, { 1, 2 }, { 7, 8 } };
+
+  double t_seek = 0;
+
+  int missing = 0;
+
+  for (int fracs_idx = 0; fracs_idx < 3; fracs_idx++)
+  {
+    mpz_mul_ui    (skip, ks_cnt, DIGEST_FRACS[fracs_idx][0]);
+    mpz_fdiv_q_ui (skip, skip,   DIGEST_FRACS[fracs_idx][1]);
+
+    mpz_sub (limit, ks_cnt, skip);
+
+    if (mpz_cmp_ui (limit, DIGEST_CANDS) > 0) mpz_set_ui (limit, DIGEST_CANDS);
+
+    if (mpz_sgn (limit) == 0) continue;
+
+    gmp_snprintf (arg1, sizeof (arg1), "--skip=%Zd",  skip);
+    gmp_snprintf (arg2, sizeof (arg2), "--limit=%Zd", limit);
+
+    pp_run (pp, wl_file, arg1, arg2, 1, &run);
+
+    if (run.failed)
+    {
+      fprintf (stderr, "%s: pp %s %s failed\n", spec, arg1, arg2);
+
+      rc = -1;
+
+      continue;
+    }
+
+    if (fracs_idx == 2) t_seek = (run.t_first > t_startup) ? run.t_first - t_startup : 0;
+
+    char key[NAME_MAX_LEN * 3];
+
+    gmp_snprintf (key, sizeof (key), "%s %Zd %Zd", spec, skip, limit);
+
+    const int check = gold_check (golds, key, run.digest, update);
+
+    if (check == -1) rc = -1;
+    if (check ==  1) missing++;
+  }
+
+  const char *result = (rc == -1) ? "FAIL" : (update) ? "recorded" : (missing) ? "no golden" : "ok";
+
+  printf ("%-18s %10llu %12.4e %10.3f %10.3f %10.3f %14.0f  %s\n", spec, (unsigned long long) words_cnt, mpz_get_d (ks_cnt), t_keyspace, t_startup, t_seek, cands_per_sec, result);
+
+  fflush (stdout);
+
+  mpz_clear (ks_cnt);
+  mpz_clear (skip);
+  mpz_clear (limit);
+
+  return rc;
+}
+
+int main (int argc, char *argv[])
+{
+  int update = 0;
+
+  int argi = 1;
+
+  if ((argc > argi) && (strcmp (argv[argi], "--update") == 0))
+  {
+    update = 1;
+
+    argi++;
+  }
+
+  if (argc - argi < 4)
+  {
+    usage (argv[0]);
+
+    return (-1);
+  }
+
+  const char *pp        = argv[argi++];
+  const char *gold_file = argv[argi++];
+  const char *wl_dir    = argv[argi++];
+
+  mkdir (wl_dir, 0755);
+
+  golds_t *golds = (golds_t *) calloc (1, sizeof (golds_t));
+
+  if (golds_load (gold_file, golds) == -1) return (-1);
+
+  printf ("%-18s %10s %12s %10s %10s %10s %14s  %s\n", "wordlist", "words", "keyspace", "keyspace-s", "startup-s", "seek-s", "cands/s", "digests");
+
+  int failed = 0;
+
+  for (; argi < argc; argi++)
+  {
+    if (bench_wordlist (pp, wl_dir, argv[argi], golds, update) == -1) failed = 1;
+  }
+
+  if (update && golds->changed)
+  {
+    if (golds_write (gold_file, golds) == -1) failed = 1;
+  }
+
+  free (golds);
+
+  return (failed) ? 1 : 0;
+}
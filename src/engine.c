@@ -0,0 +1,3034 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define __USE_MINGW_ANSI_STDIO 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "engine.h"
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: PRINCE engine shared by pp and libprince
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+/**
+ * Default word-length distribution, calculated out of first 1,000,000 entries of rockyou.txt
+ */
+
+#define DEF_WORDLEN_DIST_CNT 25
+
+static u64 DEF_WORDLEN_DIST[DEF_WORDLEN_DIST_CNT] =
+{
+  0,
+  15,
+  56,
+  350,
+  3315,
+  43721,
+  276252,
+  201748,
+  226412,
+  119885,
+  75075,
+  26323,
+  13373,
+  6353,
+  3540,
+  1877,
+  972,
+  311,
+  151,
+  81,
+  66,
+  21,
+  16,
+  13,
+  13
+};
+
+
+void check_realloc_elems (db_entry_t *db_entry, const int weighted)
+{
+  if (db_entry->elems_cnt == db_entry->elems_alloc)
+  {
+    const u64 elems_alloc = db_entry->elems_alloc;
+
+    // grow geometrically, otherwise huge wordlists spend their time in realloc ()
+
+    const u64 elems_alloc_new = (elems_alloc) ? elems_alloc * 2 : ALLOC_NEW_ELEMS;
+
+    db_entry->elems_buf = (elem_t *) realloc (db_entry->elems_buf, elems_alloc_new * sizeof (elem_t));
+
+    if (db_entry->elems_buf == NULL)
+    {
+      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+               (size_t)elems_alloc_new * sizeof (elem_t));
+
+      exit (-1);
+    }
+
+    memset (&db_entry->elems_buf[elems_alloc], 0, (elems_alloc_new - elems_alloc) * sizeof (elem_t));
+
+    if (weighted)
+    {
+      db_entry->weights_buf = (u64 *) realloc (db_entry->weights_buf, elems_alloc_new * sizeof (u64));
+
+      if (db_entry->weights_buf == NULL)
+      {
+        fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+                 (size_t)elems_alloc_new * sizeof (u64));
+
+        exit (-1);
+      }
+    }
+
+    db_entry->elems_alloc = elems_alloc_new;
+  }
+}
+
+static void check_realloc_parts (db_entry_t *db_entry)
+{
+  if (db_entry->parts_cnt == db_entry->parts_alloc)
+  {
+    const u64 parts_alloc = db_entry->parts_alloc;
+
+    const u64 parts_alloc_new = parts_alloc + ALLOC_NEW_PARTS;
+
+    db_entry->parts_buf = (part_t *) realloc (db_entry->parts_buf, parts_alloc_new * sizeof (part_t));
+
+    if (db_entry->parts_buf == NULL)
+    {
+      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+               (size_t)parts_alloc_new * sizeof (part_t));
+
+      exit (-1);
+    }
+
+    memset (&db_entry->parts_buf[parts_alloc], 0, ALLOC_NEW_PARTS * sizeof (part_t));
+
+    db_entry->parts_alloc = parts_alloc_new;
+  }
+}
+
+/**
+ * Wordlist loader: the buffer is cut into one chunk per thread at line
+ * boundaries. A first pass counts the lines per length, so the elements can
+ * be scattered into exactly presized arrays in a second pass while keeping
+ * the input order.
+ */
+
+typedef struct
+{
+  const char *buf;
+  u64         len;
+
+  db_entry_t *db_entries;
+
+  u64         cnts[IN_LEN_MAX + 1];
+  u64         offs[IN_LEN_MAX + 1];
+
+  int         pass;
+  int         weighted;
+
+} wl_chunk_t;
+
+static u64 wl_line_len (const char *buf, u64 len)
+{
+  // same result as fgets () + in_superchop (), which stop at a NUL byte
+
+  const char *nul = (const char *) memchr (buf, 0, len);
+
+  if (nul) len = nul - buf;
+
+  while (len)
+  {
+    if (buf[len - 1] == '\r')
+    {
+      len--;
+
+      continue;
+    }
+
+    break;
+  }
+
+  return len;
+}
+
+u64 wl_line_weight (const char *buf, u64 *len)
+{
+  // word<TAB>count, the line is the word with count 1 if there is no count, counts below 1 count as 1
+
+  u64 pos = *len;
+
+  while ((pos > 0) && (buf[pos - 1] >= '0') && (buf[pos - 1] <= '9')) pos--;
+
+  if ((pos == *len) || (pos == 0) || (buf[pos - 1] != '\t')) return 1;
+
+  u64 weight = 0;
+
+  for (u64 idx = pos; idx < *len; idx++)
+  {
+    const u64 digit = buf[idx] - '0';
+
+    weight = (weight > (UINT64_MAX - digit) / 10) ? UINT64_MAX : weight * 10 + digit;
+  }
+
+  *len = pos - 1;
+
+  return (weight) ? weight : 1;
+}
+
+static void *wl_chunk_worker (void *p)
+{
+  wl_chunk_t *wl_chunk = (wl_chunk_t *) p;
+
+  db_entry_t *db_entries = wl_chunk->db_entries;
+
+  const char *ptr = wl_chunk->buf;
+  const char *end = wl_chunk->buf + wl_chunk->len;
+
+  while (ptr < end)
+  {
+    const char *next = (const char *) memchr (ptr, '\n', end - ptr);
+
+    if (next == NULL) next = end;
+
+    u64 input_len = wl_line_len (ptr, next - ptr);
+
+    const u64 weight = (wl_chunk->weighted) ? wl_line_weight (ptr, &input_len) : 0;
+
+    if ((input_len >= IN_LEN_MIN) && (input_len <= IN_LEN_MAX))
+    {
+      if (wl_chunk->pass == 0)
+      {
+        wl_chunk->cnts[input_len]++;
+      }
+      else
+      {
+        db_entry_t *db_entry = &db_entries[input_len];
+
+        elem_t *elem_buf = &db_entry->elems_buf[wl_chunk->offs[input_len]];
+
+        memcpy (elem_buf->buf, ptr, input_len);
+
+        if (wl_chunk->weighted) db_entry->weights_buf[wl_chunk->offs[input_len]] = weight;
+
+        wl_chunk->offs[input_len]++;
+      }
+    }
+
+    ptr = next + 1;
+  }
+
+  return NULL;
+}
+
+static void wl_chunks_run (wl_chunk_t *wl_chunks, const int chunks_cnt, const int pass)
+{
+  pthread_t threads_buf[THREADS_MAX];
+
+  for (int chunks_idx = 0; chunks_idx < chunks_cnt; chunks_idx++)
+  {
+    wl_chunks[chunks_idx].pass = pass;
+  }
+
+  for (int chunks_idx = 1; chunks_idx < chunks_cnt; chunks_idx++)
+  {
+    pthread_create (&threads_buf[chunks_idx], NULL, wl_chunk_worker, &wl_chunks[chunks_idx]);
+  }
+
+  wl_chunk_worker (&wl_chunks[0]);
+
+  for (int chunks_idx = 1; chunks_idx < chunks_cnt; chunks_idx++)
+  {
+    pthread_join (threads_buf[chunks_idx], NULL);
+  }
+}
+
+int wl_load_buf (const char *wl_buf, const u64 wl_len, db_entry_t *db_entries, const int threads, const int weighted)
+{
+  // cut into chunks at line boundaries
+
+  const int chunks_cnt = threads;
+
+  wl_chunk_t *wl_chunks = (wl_chunk_t *) calloc (chunks_cnt, sizeof (wl_chunk_t));
+
+  u64 chunk_off = 0;
+
+  for (int chunks_idx = 0; chunks_idx < chunks_cnt; chunks_idx++)
+  {
+    wl_chunk_t *wl_chunk = &wl_chunks[chunks_idx];
+
+    u64 chunk_end = (chunks_idx == chunks_cnt - 1) ? wl_len : (wl_len / chunks_cnt) * (chunks_idx + 1);
+
+    if (chunk_end < chunk_off) chunk_end = chunk_off;
+
+    if (chunk_end < wl_len)
+    {
+      const char *next = (const char *) memchr (wl_buf + chunk_end, '\n', wl_len - chunk_end);
+
+      chunk_end = (next) ? (u64) (next - wl_buf) + 1 : wl_len;
+    }
+
+    wl_chunk->buf        = wl_buf + chunk_off;
+    wl_chunk->len        = chunk_end - chunk_off;
+    wl_chunk->db_entries = db_entries;
+    wl_chunk->weighted   = weighted;
+
+    chunk_off = chunk_end;
+  }
+
+  // pass 1: count
+
+  wl_chunks_run (wl_chunks, chunks_cnt, 0);
+
+  // presize and set the scatter offsets
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    db_entry_t *db_entry = &db_entries[input_len];
+
+    u64 elems_cnt = db_entry->elems_cnt;
+
+    for (int chunks_idx = 0; chunks_idx < chunks_cnt; chunks_idx++)
+    {
+      wl_chunk_t *wl_chunk = &wl_chunks[chunks_idx];
+
+      wl_chunk->offs[input_len] = elems_cnt;
+
+      elems_cnt += wl_chunk->cnts[input_len];
+    }
+
+    if (elems_cnt == db_entry->elems_cnt) continue;
+
+    db_entry->elems_buf = (elem_t *) realloc (db_entry->elems_buf, elems_cnt * sizeof (elem_t));
+
+    if (db_entry->elems_buf == NULL)
+    {
+      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+               (size_t) elems_cnt * sizeof (elem_t));
+
+      exit (-1);
+    }
+
+    memset (&db_entry->elems_buf[db_entry->elems_cnt], 0, (elems_cnt - db_entry->elems_cnt) * sizeof (elem_t));
+
+    if (weighted)
+    {
+      db_entry->weights_buf = (u64 *) realloc (db_entry->weights_buf, elems_cnt * sizeof (u64));
+
+      if (db_entry->weights_buf == NULL)
+      {
+        fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+                 (size_t) elems_cnt * sizeof (u64));
+
+        exit (-1);
+      }
+    }
+
+    db_entry->elems_cnt   = elems_cnt;
+    db_entry->elems_alloc = elems_cnt;
+  }
+
+  // pass 2: scatter
+
+  wl_chunks_run (wl_chunks, chunks_cnt, 1);
+
+  free (wl_chunks);
+
+  return 0;
+}
+
+/**
+ * Input deduplication: open addressing with linear probing over the element
+ * index, elements are compared as a whole since elem_t is zero padded.
+ * The first occurrence is kept so the element order stays the same, with
+ * weighted input it gets the counts of all occurrences.
+ */
+
+u64 elem_hash (const elem_t *elem_buf)
+{
+  u64 v[2];
+
+  memcpy (v, elem_buf->buf, sizeof (v));
+
+  u64 h = (v[0] * 0x9e3779b97f4a7c15ULL) ^ (v[1] + 0x632be59bd9b4e019ULL);
+
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+
+  return h;
+}
+
+u64 elems_dedup (db_entry_t *db_entry)
+{
+  const u64 elems_cnt = db_entry->elems_cnt;
+
+  if (elems_cnt < 2) return 0;
+
+  u64 table_size = 1;
+
+  while (table_size < elems_cnt * 2) table_size <<= 1;
+
+  const u64 table_mask = table_size - 1;
+
+  // slot value is index + 1, 0 is empty
+
+  u64 *table_buf = (u64 *) calloc (table_size, sizeof (u64));
+
+  if (table_buf == NULL)
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+             (size_t) table_size * sizeof (u64));
+
+    exit (-1);
+  }
+
+  elem_t *elems_buf = db_entry->elems_buf;
+
+  u64 *weights_buf = db_entry->weights_buf;
+
+  u64 elems_new = 0;
+
+  for (u64 elems_idx = 0; elems_idx < elems_cnt; elems_idx++)
+  {
+    const elem_t *elem_buf = &elems_buf[elems_idx];
+
+    u64 slot = elem_hash (elem_buf) & table_mask;
+
+    int dupe = 0;
+
+    while (table_buf[slot])
+    {
+      if (memcmp (&elems_buf[table_buf[slot] - 1], elem_buf, sizeof (elem_t)) == 0)
+      {
+        dupe = 1;
+
+        if (weights_buf)
+        {
+          u64 *weight = &weights_buf[table_buf[slot] - 1];
+
+          *weight = (*weight > UINT64_MAX - weights_buf[elems_idx]) ? UINT64_MAX : *weight + weights_buf[elems_idx];
+        }
+
+        break;
+      }
+
+      slot = (slot + 1) & table_mask;
+    }
+
+    if (dupe) continue;
+
+    if (elems_new != elems_idx)
+    {
+      elems_buf[elems_new] = *elem_buf;
+
+      if (weights_buf) weights_buf[elems_new] = weights_buf[elems_idx];
+    }
+
+    elems_new++;
+
+    table_buf[slot] = elems_new;
+  }
+
+  free (table_buf);
+
+  db_entry->elems_cnt = elems_new;
+
+  return elems_cnt - elems_new;
+}
+
+static int sort_by_cnt (const void *p1, const void *p2)
+{
+  const pw_order_t *o1 = (const pw_order_t *) p1;
+  const pw_order_t *o2 = (const pw_order_t *) p2;
+
+  // Descending order
+  if (o1->cnt > o2->cnt) return -1;
+  if (o1->cnt < o2->cnt) return  1;
+
+  return 0;
+}
+
+static int sort_by_ks (const void *p1, const void *p2)
+{
+  const part_t *f1 = (const part_t *) p1;
+  const part_t *f2 = (const part_t *) p2;
+
+  return mpz_cmp (f1->ks_cnt, f2->ks_cnt);
+}
+
+static int sort_by_score (const void *p1, const void *p2)
+{
+  const part_t *f1 = (const part_t *) p1;
+  const part_t *f2 = (const part_t *) p2;
+
+  // Descending order, equal scores by ks
+  if (f1->score > f2->score) return -1;
+  if (f1->score < f2->score) return  1;
+
+  return mpz_cmp (f1->ks_cnt, f2->ks_cnt);
+}
+
+typedef struct
+{
+  int mask;
+  u64 weight;
+  u64 idx;
+
+} elem_rank_t;
+
+static int sort_by_weight (const void *p1, const void *p2)
+{
+  const elem_rank_t *r1 = (const elem_rank_t *) p1;
+  const elem_rank_t *r2 = (const elem_rank_t *) p2;
+
+  // Ascending masks, descending weights, equal weights keep the input order
+  if (r1->mask < r2->mask) return -1;
+  if (r1->mask > r2->mask) return  1;
+
+  if (r1->weight > r2->weight) return -1;
+  if (r1->weight < r2->weight) return  1;
+
+  if (r1->idx < r2->idx) return -1;
+  if (r1->idx > r2->idx) return  1;
+
+  return 0;
+}
+
+static int buf_mask (const u8 *buf, const int len)
+{
+  int mask = 0;
+
+  for (int idx = 0; idx < len; idx++)
+  {
+    const u8 c = buf[idx];
+
+    if      ((c >= 'a') && (c <= 'z')) mask |= CLASS_LOWER;
+    else if ((c >= 'A') && (c <= 'Z')) mask |= CLASS_UPPER;
+    else if ((c >= '0') && (c <= '9')) mask |= CLASS_DIGIT;
+    else                               mask |= CLASS_SPECIAL;
+  }
+
+  return mask;
+}
+
+static int elem_mask (const elem_t *elem_buf, const int elem_len)
+{
+  return buf_mask (elem_buf->buf, elem_len);
+}
+
+static void elems_sort (db_entry_t *db_entry, const int elem_len)
+{
+  // by class mask for --require, by weight for --weighted, otherwise the input order
+
+  const u64 elems_cnt = db_entry->elems_cnt;
+
+  const int req_mask = db_entry->req_mask;
+
+  u64 masks_cnts[CLASS_MASKS] = { 0 };
+
+  if ((elems_cnt < 2) || ((req_mask == 0) && (db_entry->weights_buf == NULL)))
+  {
+    // nothing to sort, all elements have the same mask
+
+    const int mask = ((req_mask) && (elems_cnt)) ? elem_mask (&db_entry->elems_buf[0], elem_len) & req_mask : 0;
+
+    masks_cnts[mask] = elems_cnt;
+
+    for (int mask = 0; mask < CLASS_MASKS; mask++)
+    {
+      db_entry->masks_offs[mask + 1] = db_entry->masks_offs[mask] + masks_cnts[mask];
+    }
+
+    return;
+  }
+
+  elem_rank_t *ranks_buf = (elem_rank_t *) malloc (elems_cnt * sizeof (elem_rank_t));
+  elem_t      *elems_new = (elem_t *)      malloc (elems_cnt * sizeof (elem_t));
+
+  if ((ranks_buf == NULL) || (elems_new == NULL))
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+             (size_t) elems_cnt * sizeof (elem_rank_t));
+
+    exit (-1);
+  }
+
+  for (u64 elems_idx = 0; elems_idx < elems_cnt; elems_idx++)
+  {
+    ranks_buf[elems_idx].mask   = elem_mask (&db_entry->elems_buf[elems_idx], elem_len) & req_mask;
+    ranks_buf[elems_idx].weight = (db_entry->weights_buf) ? db_entry->weights_buf[elems_idx] : 0;
+    ranks_buf[elems_idx].idx    = elems_idx;
+
+    masks_cnts[ranks_buf[elems_idx].mask]++;
+  }
+
+  qsort (ranks_buf, elems_cnt, sizeof (elem_rank_t), sort_by_weight);
+
+  for (u64 elems_idx = 0; elems_idx < elems_cnt; elems_idx++)
+  {
+    elems_new[elems_idx] = db_entry->elems_buf[ranks_buf[elems_idx].idx];
+
+    if (db_entry->weights_buf) db_entry->weights_buf[elems_idx] = ranks_buf[elems_idx].weight;
+  }
+
+  for (int mask = 0; mask < CLASS_MASKS; mask++)
+  {
+    db_entry->masks_offs[mask + 1] = db_entry->masks_offs[mask] + masks_cnts[mask];
+  }
+
+  free (db_entry->elems_buf);
+
+  db_entry->elems_buf   = elems_new;
+  db_entry->elems_alloc = elems_cnt;
+
+  free (ranks_buf);
+}
+
+/**
+ * Keyspace without any chains: ks_tbl[len][cnt][mask] is the number of
+ * candidates of length len built out of exactly cnt elements whose classes
+ * together are mask, which is the sum over all chains of the products of
+ * their element counts. Without a policy all elements have mask 0.
+ */
+
+void keyspace_calc (const u64 elems_cnts[IN_LEN_MAX + 1][CLASS_MASKS], const int req_mask, const int pw_min, const int pw_max, const int elem_cnt_min, const int elem_cnt_max, mpz_t *pw_ks_cnts, mpz_t total_ks_cnt)
+{
+  mpz_t ks_tbl[OUT_LEN_MAX + 1][CHAIN_ELEMS_MAX + 1][CLASS_MASKS];
+
+  for (int len = 0; len <= pw_max; len++)
+  {
+    for (int cnt = 0; cnt <= elem_cnt_max; cnt++)
+    {
+      for (int mask = 0; mask <= req_mask; mask++)
+      {
+        mpz_init (ks_tbl[len][cnt][mask]);
+      }
+    }
+  }
+
+  mpz_set_si (ks_tbl[0][0][0], 1);
+
+  for (int len = 1; len <= pw_max; len++)
+  {
+    for (int cnt = 1; cnt <= elem_cnt_max; cnt++)
+    {
+      for (int elem_len = IN_LEN_MIN; elem_len <= MIN (len, IN_LEN_MAX); elem_len++)
+      {
+        for (int elem_mask = 0; elem_mask <= req_mask; elem_mask++)
+        {
+          const u64 elems_cnt = elems_cnts[elem_len][elem_mask];
+
+          if (elems_cnt == 0) continue;
+
+          for (int mask = 0; mask <= req_mask; mask++)
+          {
+            if (mask & ~req_mask) continue;
+
+            mpz_addmul_ui (ks_tbl[len][cnt][mask | elem_mask], ks_tbl[len - elem_len][cnt - 1][mask], elems_cnt);
+          }
+        }
+      }
+    }
+  }
+
+  mpz_set_si (total_ks_cnt, 0);
+
+  for (int len = pw_min; len <= pw_max; len++)
+  {
+    if (pw_ks_cnts) mpz_set_si (pw_ks_cnts[len], 0);
+
+    for (int cnt = elem_cnt_min; cnt <= elem_cnt_max; cnt++)
+    {
+      if (pw_ks_cnts) mpz_add (pw_ks_cnts[len], pw_ks_cnts[len], ks_tbl[len][cnt][req_mask]);
+
+      mpz_add (total_ks_cnt, total_ks_cnt, ks_tbl[len][cnt][req_mask]);
+    }
+  }
+
+  for (int len = 0; len <= pw_max; len++)
+  {
+    for (int cnt = 0; cnt <= elem_cnt_max; cnt++)
+    {
+      for (int mask = 0; mask <= req_mask; mask++)
+      {
+        mpz_clear (ks_tbl[len][cnt][mask]);
+      }
+    }
+  }
+}
+
+/**
+ * Policies: the elements of a length are grouped by mask, a position of a
+ * chain can take every mask with a non-empty group. cover[idx] has bit need
+ * set if the positions below idx can cover the classes need, valid_tbl[idx][need]
+ * is the number of their combinations that do. The odometer only stops at
+ * combinations covering req_mask.
+ */
+
+#define REQ_STEPS_MAX 64
+
+static int elem_group (const db_entry_t *db_entry, const u64 elems_idx)
+{
+  int mask = 0;
+
+  while ((mask < CLASS_MASKS) && (db_entry->masks_offs[mask + 1] <= elems_idx)) mask++;
+
+  return mask;
+}
+
+static void chain_cover (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, u32 cover[CHAIN_ELEMS_MAX + 1])
+{
+  const int cnt = chain_buf->cnt;
+
+  cover[0] = 1;
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    cover[idx + 1] = 0;
+
+    for (int need = 0; need <= req_mask; need++)
+    {
+      if (need & ~req_mask) continue;
+
+      for (int mask = 0; mask <= req_mask; mask++)
+      {
+        if (db_entry->masks_offs[mask] == db_entry->masks_offs[mask + 1]) continue;
+
+        if ((cover[idx] >> (need & ~mask)) & 1)
+        {
+          cover[idx + 1] |= 1u << need;
+
+          break;
+        }
+      }
+    }
+  }
+}
+
+static void valid_tbl_init (mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS], const int cnt, const int req_mask)
+{
+  for (int idx = 0; idx <= cnt; idx++)
+  {
+    for (int need = 0; need <= req_mask; need++) mpz_init (valid_tbl[idx][need]);
+  }
+}
+
+static void valid_tbl_clear (mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS], const int cnt, const int req_mask)
+{
+  for (int idx = 0; idx <= cnt; idx++)
+  {
+    for (int need = 0; need <= req_mask; need++) mpz_clear (valid_tbl[idx][need]);
+  }
+}
+
+static void chain_valid_tbl (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS])
+{
+  const int cnt = chain_buf->cnt;
+
+  for (int need = 0; need <= req_mask; need++)
+  {
+    mpz_set_si (valid_tbl[0][need], (need == 0) ? 1 : 0);
+  }
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    for (int need = 0; need <= req_mask; need++)
+    {
+      mpz_set_si (valid_tbl[idx + 1][need], 0);
+
+      if (need & ~req_mask) continue;
+
+      for (int mask = 0; mask <= req_mask; mask++)
+      {
+        const u64 elems_cnt = db_entry->masks_offs[mask + 1] - db_entry->masks_offs[mask];
+
+        if (elems_cnt == 0) continue;
+
+        mpz_addmul_ui (valid_tbl[idx + 1][need], valid_tbl[idx][need & ~mask], elems_cnt);
+      }
+    }
+  }
+}
+
+static void chain_valid_fill (const chain_t *chain_buf, const db_entry_t *db_entries, const u32 cover[CHAIN_ELEMS_MAX + 1], u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], int idx, int need)
+{
+  // the smallest combination of the positions below idx covering need
+
+  while (idx--)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    int mask;
+
+    for (mask = 0; mask < CLASS_MASKS - 1; mask++)
+    {
+      if (db_entry->masks_offs[mask] == db_entry->masks_offs[mask + 1]) continue;
+
+      if ((cover[idx] >> (need & ~mask)) & 1) break;
+    }
+
+    cur_chain_ks_poses[idx] = db_entry->masks_offs[mask];
+
+    need &= ~mask;
+  }
+}
+
+static int chain_valid_next (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, const u32 cover[CHAIN_ELEMS_MAX + 1], u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], const int idx_beg)
+{
+  // the next combination covering req_mask, the positions from idx_beg on move, returns 0 at the end of the chain
+
+  const int cnt = chain_buf->cnt;
+
+  int above[CHAIN_ELEMS_MAX];
+
+  above[cnt - 1] = 0;
+
+  for (int idx = cnt - 2; idx >= 0; idx--)
+  {
+    above[idx] = above[idx + 1] | elem_group (&db_entries[chain_buf->buf[idx + 1]], cur_chain_ks_poses[idx + 1]);
+  }
+
+  for (int idx = idx_beg; idx < cnt; idx++)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    const int need = req_mask & ~above[idx];
+
+    const u64 elems_idx = cur_chain_ks_poses[idx] + 1;
+
+    for (int mask = elem_group (db_entry, elems_idx); mask < CLASS_MASKS; mask++)
+    {
+      if (db_entry->masks_offs[mask] == db_entry->masks_offs[mask + 1]) continue;
+
+      if (((cover[idx] >> (need & ~mask)) & 1) == 0) continue;
+
+      cur_chain_ks_poses[idx] = MAX (db_entry->masks_offs[mask], elems_idx);
+
+      chain_valid_fill (chain_buf, db_entries, cover, cur_chain_ks_poses, idx, need & ~mask);
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static u64 chain_valid_run_end (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, const u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX])
+{
+  // the end of the run of allowed elements of the first position, the others decide which masks are allowed
+
+  int above = 0;
+
+  for (int idx = 1; idx < chain_buf->cnt; idx++)
+  {
+    above |= elem_group (&db_entries[chain_buf->buf[idx]], cur_chain_ks_poses[idx]);
+  }
+
+  const int need = req_mask & ~above;
+
+  const db_entry_t *db_entry = &db_entries[chain_buf->buf[0]];
+
+  int mask = elem_group (db_entry, cur_chain_ks_poses[0]);
+
+  u64 run_end = db_entry->masks_offs[mask + 1];
+
+  for (mask++; mask < CLASS_MASKS; mask++)
+  {
+    if (db_entry->masks_offs[mask] == db_entry->masks_offs[mask + 1]) continue;
+
+    if (need & ~mask) break;
+
+    run_end = db_entry->masks_offs[mask + 1];
+  }
+
+  return run_end;
+}
+
+static void chain_valid_rank (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS], const u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], mpz_t rank)
+{
+  mpz_set_si (rank, 0);
+
+  int need = req_mask;
+
+  for (int idx = chain_buf->cnt - 1; idx >= 0; idx--)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    const u64 elems_idx = cur_chain_ks_poses[idx];
+
+    for (int mask = 0; mask <= req_mask; mask++)
+    {
+      const u64 mask_beg = db_entry->masks_offs[mask];
+
+      if (mask_beg >= elems_idx) break;
+
+      const u64 mask_end = MIN (db_entry->masks_offs[mask + 1], elems_idx);
+
+      mpz_addmul_ui (rank, valid_tbl[idx][need & ~mask], mask_end - mask_beg);
+    }
+
+    need &= ~elem_group (db_entry, elems_idx);
+  }
+}
+
+static void chain_valid_unrank (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS], mpz_t rank, mpz_t tmp, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX])
+{
+  int need = req_mask;
+
+  for (int idx = chain_buf->cnt - 1; idx >= 0; idx--)
+  {
+    const db_entry_t *db_entry = &db_entries[chain_buf->buf[idx]];
+
+    for (int mask = 0; mask <= req_mask; mask++)
+    {
+      const u64 elems_cnt = db_entry->masks_offs[mask + 1] - db_entry->masks_offs[mask];
+
+      if (elems_cnt == 0) continue;
+
+      mpz_srcptr sub_cnt = valid_tbl[idx][need & ~mask];
+
+      if (mpz_sgn (sub_cnt) == 0) continue;
+
+      mpz_mul_ui (tmp, sub_cnt, elems_cnt);
+
+      if (mpz_cmp (rank, tmp) >= 0)
+      {
+        mpz_sub (rank, rank, tmp);
+
+        continue;
+      }
+
+      mpz_tdiv_qr (tmp, rank, rank, sub_cnt);
+
+      cur_chain_ks_poses[idx] = db_entry->masks_offs[mask] + mpz_get_ui (tmp);
+
+      need &= ~mask;
+
+      break;
+    }
+  }
+}
+
+static void chain_ks_poses_first (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX])
+{
+  memset (cur_chain_ks_poses, 0, CHAIN_ELEMS_MAX * sizeof (u64));
+
+  const int req_mask = db_entries[chain_buf->buf[0]].req_mask;
+
+  if (req_mask == 0) return;
+
+  u32 cover[CHAIN_ELEMS_MAX + 1];
+
+  chain_cover (chain_buf, db_entries, req_mask, cover);
+
+  chain_valid_fill (chain_buf, db_entries, cover, cur_chain_ks_poses, chain_buf->cnt, req_mask);
+}
+
+static void chain_ks (const chain_t *chain_buf, const db_entry_t *db_entries, mpz_t ks_cnt)
+{
+  const u8 *buf = chain_buf->buf;
+  const int cnt = chain_buf->cnt;
+
+  const int req_mask = db_entries[buf[0]].req_mask;
+
+  if (req_mask)
+  {
+    mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS];
+
+    valid_tbl_init  (valid_tbl, cnt, req_mask);
+    chain_valid_tbl (chain_buf, db_entries, req_mask, valid_tbl);
+
+    mpz_set (ks_cnt, valid_tbl[cnt][req_mask]);
+
+    valid_tbl_clear (valid_tbl, cnt, req_mask);
+
+    return;
+  }
+
+  mpz_set_si (ks_cnt, 1);
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    const u8 db_key = buf[idx];
+
+    const db_entry_t *db_entry = &db_entries[db_key];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    mpz_mul_ui (ks_cnt, ks_cnt, elems_cnt);
+  }
+}
+
+static void set_chain_ks_poses (const chain_t *chain_buf, const db_entry_t *db_entries, mpz_t tmp, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX])
+{
+  const u8 *buf = chain_buf->buf;
+
+  const int cnt = chain_buf->cnt;
+
+  const int req_mask = db_entries[buf[0]].req_mask;
+
+  if (req_mask)
+  {
+    mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS];
+
+    mpz_t sub; mpz_init (sub);
+
+    valid_tbl_init     (valid_tbl, cnt, req_mask);
+    chain_valid_tbl    (chain_buf, db_entries, req_mask, valid_tbl);
+    chain_valid_unrank (chain_buf, db_entries, req_mask, valid_tbl, tmp, sub, cur_chain_ks_poses);
+    valid_tbl_clear    (valid_tbl, cnt, req_mask);
+
+    mpz_clear (sub);
+
+    return;
+  }
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    const u8 db_key = buf[idx];
+
+    const db_entry_t *db_entry = &db_entries[db_key];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    cur_chain_ks_poses[idx] = mpz_fdiv_ui (tmp, elems_cnt);
+
+    mpz_div_ui (tmp, tmp, elems_cnt);
+  }
+}
+
+void chain_set_pwbuf_init (const chain_t *chain_buf, const db_entry_t *db_entries, const u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf)
+{
+  const u8 *buf = chain_buf->buf;
+
+  const u32 cnt = chain_buf->cnt;
+
+  for (u32 idx = 0; idx < cnt; idx++)
+  {
+    const u8 db_key = buf[idx];
+
+    const db_entry_t *db_entry = &db_entries[db_key];
+
+    const u64 elems_idx = cur_chain_ks_poses[idx];
+
+    memcpy (pw_buf, &db_entry->elems_buf[elems_idx], db_key);
+
+    pw_buf += db_key;
+  }
+}
+
+static void chain_set_pwbuf_increment (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf)
+{
+  const u8 *buf = chain_buf->buf;
+
+  const int cnt = chain_buf->cnt;
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    const u8 db_key = buf[idx];
+
+    const db_entry_t *db_entry = &db_entries[db_key];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    const u64 elems_idx = ++cur_chain_ks_poses[idx];
+
+    if (elems_idx < elems_cnt)
+    {
+      memcpy (pw_buf, &db_entry->elems_buf[elems_idx], db_key);
+
+      break;
+    }
+
+    cur_chain_ks_poses[idx] = 0;
+
+    memcpy (pw_buf, &db_entry->elems_buf[0], db_key);
+
+    pw_buf += db_key;
+  }
+}
+
+/**
+ * Emit kernels: inside a chain the first element varies fastest, so a run of
+ * candidates only differs in its first element. The first element is written
+ * with a whole elem_t store, the rest of the candidate is kept in pw_buf and
+ * copied behind it with a fixed-size store, the cursor only advances by the
+ * real length. The element length is known at compile time.
+ * A record of rec_len bytes is the candidate at offset rec_pre plus what the
+ * output format puts around it. pw_buf is the template of one record followed
+ * by the prefix of the next one, so the store behind the element also writes
+ * the prefix of the next record. It is the candidate plus a newline for the
+ * text output.
+ * The destination needs OUT_SLACK bytes after the last candidate, pw_buf
+ * needs to be OUT_SLACK bytes large.
+ */
+
+static inline void emit_run (char *dst, const char *pw_buf, const int rec_pre, const int rec_len, const elem_t *elems_buf, const u64 run, const int elem_len, const int tpl_size)
+{
+  const char *tpl_buf = pw_buf + rec_pre + elem_len;
+
+  dst += rec_pre;
+
+  for (u64 run_pos = 0; run_pos < run; run_pos++)
+  {
+    memcpy (dst, elems_buf[run_pos].buf, sizeof (elem_t));
+
+    memcpy (dst + elem_len, tpl_buf, tpl_size);
+
+    dst += rec_len;
+  }
+}
+
+#define EMIT_RUN_CASE(n)                                                                         \
+  case n:                                                                                        \
+    if (tpl_size == 16) emit_run (dst, pw_buf, rec_pre, rec_len, elems_buf, run, n, 16);          \
+    else                emit_run (dst, pw_buf, rec_pre, rec_len, elems_buf, run, n, PW_BUF_SIZE); \
+    break;
+
+u64 chain_emit (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf, const int rec_pre, const int rec_len, u64 iter_cnt, char *out_buf)
+{
+  const u8 elem_len = chain_buf->buf[0];
+
+  const int tpl_size = ((rec_len - elem_len) <= 16) ? 16 : PW_BUF_SIZE;
+
+  const db_entry_t *db_entry = &db_entries[elem_len];
+
+  const u64 elems_cnt = db_entry->elems_cnt;
+
+  const int req_mask = db_entry->req_mask;
+
+  u32 cover[CHAIN_ELEMS_MAX + 1];
+
+  if (req_mask) chain_cover (chain_buf, db_entries, req_mask, cover);
+
+  char *dst = out_buf;
+
+  // the prefix of the first record, the others come from the template
+
+  memcpy (dst, pw_buf, rec_pre);
+
+  while (iter_cnt)
+  {
+    const u64 elems_idx = cur_chain_ks_poses[0];
+
+    // with a policy a run ends at the first mask of the first element the others do not allow
+
+    const u64 run_end = (req_mask) ? chain_valid_run_end (chain_buf, db_entries, req_mask, cur_chain_ks_poses) : elems_cnt;
+
+    const u64 run = MIN (iter_cnt, run_end - elems_idx);
+
+    const elem_t *elems_buf = &db_entry->elems_buf[elems_idx];
+
+    switch (elem_len)
+    {
+      EMIT_RUN_CASE (1)
+      EMIT_RUN_CASE (2)
+      EMIT_RUN_CASE (3)
+      EMIT_RUN_CASE (4)
+      EMIT_RUN_CASE (5)
+      EMIT_RUN_CASE (6)
+      EMIT_RUN_CASE (7)
+      EMIT_RUN_CASE (8)
+      EMIT_RUN_CASE (9)
+      EMIT_RUN_CASE (10)
+      EMIT_RUN_CASE (11)
+      EMIT_RUN_CASE (12)
+      EMIT_RUN_CASE (13)
+      EMIT_RUN_CASE (14)
+      EMIT_RUN_CASE (15)
+      EMIT_RUN_CASE (16)
+    }
+
+    dst += run * rec_len;
+
+    iter_cnt -= run;
+
+    if ((elems_idx + run) < run_end)
+    {
+      cur_chain_ks_poses[0] = elems_idx + run;
+
+      memcpy (pw_buf + rec_pre, &db_entry->elems_buf[elems_idx + run], elem_len);
+    }
+    else if (req_mask)
+    {
+      cur_chain_ks_poses[0] = run_end - 1;
+
+      if (chain_valid_next (chain_buf, db_entries, req_mask, cover, cur_chain_ks_poses, 0) == 0) break;
+
+      chain_set_pwbuf_init (chain_buf, db_entries, cur_chain_ks_poses, pw_buf + rec_pre);
+    }
+    else
+    {
+      // let the odometer wrap the first element and carry into the others
+
+      cur_chain_ks_poses[0] = elems_cnt - 1;
+
+      chain_set_pwbuf_increment (chain_buf, db_entries, cur_chain_ks_poses, pw_buf + rec_pre);
+    }
+  }
+
+  return dst - out_buf;
+}
+
+static u64 chain_perms_cnt (const chain_t *chain_buf)
+{
+  // number of distinct orderings, the elements are sorted
+
+  const u8 *buf = chain_buf->buf;
+
+  const int cnt = chain_buf->cnt;
+
+  u64 perms_cnt = 1;
+
+  int run = 0;
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    run = ((idx > 0) && (buf[idx] == buf[idx - 1])) ? run + 1 : 1;
+
+    perms_cnt = perms_cnt * (idx + 1) / run;
+  }
+
+  return perms_cnt;
+}
+
+static void parts_gen (db_entry_t *db_entry, const db_entry_t *db_entries, chain_t *chain_buf, const int len_left, const int elem_len_max, const int elem_cnt_min, const int elem_cnt_max)
+{
+  if (len_left == 0)
+  {
+    if (chain_buf->cnt < elem_cnt_min) return;
+
+    check_realloc_parts (db_entry);
+
+    part_t *part = &db_entry->parts_buf[db_entry->parts_cnt];
+
+    memcpy (&part->chain_buf, chain_buf, sizeof (chain_t));
+
+    part->perms_cnt = chain_perms_cnt (chain_buf);
+
+    mpz_init (part->ks_cnt);
+
+    chain_ks (chain_buf, db_entries, part->ks_cnt);
+
+    // a policy can leave a part without any candidate
+
+    if (mpz_sgn (part->ks_cnt) == 0)
+    {
+      mpz_clear (part->ks_cnt);
+
+      return;
+    }
+
+    db_entry->parts_cnt++;
+
+    return;
+  }
+
+  const int elems_left = elem_cnt_max - chain_buf->cnt;
+
+  if (len_left > elems_left * elem_len_max) return;
+
+  for (int elem_len = MIN (len_left, elem_len_max); elem_len >= IN_LEN_MIN; elem_len--)
+  {
+    if (db_entries[elem_len].elems_cnt == 0) continue;
+
+    chain_buf->buf[chain_buf->cnt] = elem_len;
+
+    chain_buf->cnt++;
+
+    parts_gen (db_entry, db_entries, chain_buf, len_left - elem_len, elem_len, elem_cnt_min, elem_cnt_max);
+
+    chain_buf->cnt--;
+  }
+}
+
+static u64 part_mask (const part_t *part)
+{
+  // bit (n - 1) is set if an element ends at position n, like the chains_idx of the old chain table
+
+  const u8 *rev = part->rev;
+
+  const int cnt = part->chain_buf.cnt;
+
+  u64 mask = 0;
+
+  int cut = 0;
+
+  for (int idx = cnt - 1; idx > 0; idx--)
+  {
+    cut += rev[idx];
+
+    mask |= 1ULL << (cut - 1);
+  }
+
+  return mask;
+}
+
+static int part_perm_next (part_t *part)
+{
+  // the next higher mask is the lexicographically previous reversed ordering
+
+  u8 *rev = part->rev;
+
+  const int cnt = part->chain_buf.cnt;
+
+  int i = cnt - 2;
+
+  while ((i >= 0) && (rev[i] <= rev[i + 1])) i--;
+
+  if (i < 0) return 0;
+
+  int j = cnt - 1;
+
+  while (rev[j] >= rev[i]) j--;
+
+  u8 t = rev[i]; rev[i] = rev[j]; rev[j] = t;
+
+  for (int l = i + 1, r = cnt - 1; l < r; l++, r--)
+  {
+    t = rev[l]; rev[l] = rev[r]; rev[r] = t;
+  }
+
+  part->mask = part_mask (part);
+
+  return 1;
+}
+
+static void parts_heap_push (db_entry_t *db_entry, const int parts_idx)
+{
+  const part_t *parts_buf = db_entry->parts_buf;
+
+  int *heap_buf = db_entry->heap_buf;
+
+  int pos = db_entry->heap_cnt++;
+
+  while (pos)
+  {
+    const int up = (pos - 1) / 2;
+
+    if (parts_buf[heap_buf[up]].mask <= parts_buf[parts_idx].mask) break;
+
+    heap_buf[pos] = heap_buf[up];
+
+    pos = up;
+  }
+
+  heap_buf[pos] = parts_idx;
+}
+
+static int parts_heap_pop (db_entry_t *db_entry)
+{
+  const part_t *parts_buf = db_entry->parts_buf;
+
+  int *heap_buf = db_entry->heap_buf;
+
+  const int top = heap_buf[0];
+
+  const int last = heap_buf[--db_entry->heap_cnt];
+
+  const int heap_cnt = db_entry->heap_cnt;
+
+  int pos = 0;
+
+  while (1)
+  {
+    int down = pos * 2 + 1;
+
+    if (down >= heap_cnt) break;
+
+    if ((down + 1 < heap_cnt) && (parts_buf[heap_buf[down + 1]].mask < parts_buf[heap_buf[down]].mask)) down++;
+
+    if (parts_buf[last].mask <= parts_buf[heap_buf[down]].mask) break;
+
+    heap_buf[pos] = heap_buf[down];
+
+    pos = down;
+  }
+
+  heap_buf[pos] = last;
+
+  return top;
+}
+
+static void chain_src_group (db_entry_t *db_entry)
+{
+  // load all parts of the current keyspace group
+
+  const grp_t *grp = &db_entry->grps_buf[db_entry->grps_pos];
+
+  db_entry->grp_chains_pos = 0;
+
+  for (int parts_idx = grp->parts_beg; parts_idx < grp->parts_end; parts_idx++)
+  {
+    part_t *part = &db_entry->parts_buf[parts_idx];
+
+    memcpy (part->rev, part->chain_buf.buf, CHAIN_ELEMS_MAX);
+
+    part->mask = part_mask (part);
+
+    parts_heap_push (db_entry, parts_idx);
+  }
+}
+
+static void chain_src_set (db_entry_t *db_entry, const int parts_idx)
+{
+  const part_t *part = &db_entry->parts_buf[parts_idx];
+
+  const int cnt = part->chain_buf.cnt;
+
+  chain_t *chain_buf = &db_entry->chain_buf;
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    chain_buf->buf[idx] = part->rev[cnt - 1 - idx];
+  }
+
+  chain_buf->cnt = cnt;
+
+  db_entry->chain_part = parts_idx;
+}
+
+static void chain_src_pick (db_entry_t *db_entry)
+{
+  chain_src_set (db_entry, parts_heap_pop (db_entry));
+}
+
+static void chain_src_init (db_entry_t *db_entry)
+{
+  // split the sorted parts into groups of the same keyspace, with the chains and keyspace in front of each
+
+  part_t *parts_buf = db_entry->parts_buf;
+
+  const int parts_cnt = db_entry->parts_cnt;
+
+  db_entry->grps_buf = (grp_t *) malloc ((parts_cnt + 1) * sizeof (grp_t));
+  db_entry->grps_cnt = 0;
+
+  mpz_t ks_beg; mpz_init_set_si (ks_beg, 0);
+
+  u64 chains_beg = 0;
+
+  for (int parts_beg = 0, parts_end = 0; parts_beg < parts_cnt; parts_beg = parts_end)
+  {
+    parts_end = parts_beg + 1;
+
+    while ((parts_end < parts_cnt) && (mpz_cmp (parts_buf[parts_end].ks_cnt, parts_buf[parts_beg].ks_cnt) == 0) && (parts_buf[parts_end].score == parts_buf[parts_beg].score)) parts_end++;
+
+    grp_t *grp = &db_entry->grps_buf[db_entry->grps_cnt];
+
+    grp->parts_beg  = parts_beg;
+    grp->parts_end  = parts_end;
+    grp->chains_beg = chains_beg;
+    grp->chains_cnt = 0;
+
+    for (int parts_idx = parts_beg; parts_idx < parts_end; parts_idx++)
+    {
+      grp->chains_cnt += parts_buf[parts_idx].perms_cnt;
+    }
+
+    mpz_init_set (grp->ks_beg, ks_beg);
+
+    mpz_addmul_ui (ks_beg, parts_buf[parts_beg].ks_cnt, grp->chains_cnt);
+
+    chains_beg += grp->chains_cnt;
+
+    db_entry->grps_cnt++;
+  }
+
+  mpz_clear (ks_beg);
+
+  db_entry->heap_cnt   = 0;
+  db_entry->grps_pos   = 0;
+  db_entry->chains_pos = 0;
+
+  mpz_set_si (db_entry->chain_ks_pos, 0);
+
+  if (db_entry->parts_cnt == 0) return;
+
+  chain_src_group (db_entry);
+  chain_src_pick  (db_entry);
+}
+
+static void chain_src_next (db_entry_t *db_entry)
+{
+  db_entry->chains_pos++;
+  db_entry->grp_chains_pos++;
+
+  mpz_set_si (db_entry->chain_ks_pos, 0);
+
+  if (part_perm_next (&db_entry->parts_buf[db_entry->chain_part]))
+  {
+    parts_heap_push (db_entry, db_entry->chain_part);
+  }
+
+  if (db_entry->heap_cnt == 0)
+  {
+    if (db_entry->grps_pos + 1 == db_entry->grps_cnt) return;
+
+    db_entry->grps_pos++;
+
+    chain_src_group (db_entry);
+  }
+
+  chain_src_pick (db_entry);
+}
+
+static u64 elem_lens_perms_cnt (const u8 lens_cnts[IN_LEN_MAX + 1])
+{
+  // number of distinct orderings of a multiset of element lengths
+
+  u64 perms_cnt = 1;
+
+  int idx = 0;
+
+  for (int elem_len = IN_LEN_MIN; elem_len <= IN_LEN_MAX; elem_len++)
+  {
+    for (int run = 1; run <= lens_cnts[elem_len]; run++)
+    {
+      idx++;
+
+      perms_cnt = perms_cnt * idx / run;
+    }
+  }
+
+  return perms_cnt;
+}
+
+static int part_seek (part_t *part, const u8 *rev, const int cnt)
+{
+  // move the part to its first ordering behind the given one, that is the largest reversed ordering below it
+
+  u8 lens_cnts[IN_LEN_MAX + 1] = { 0 };
+
+  for (int idx = 0; idx < part->chain_buf.cnt; idx++)
+  {
+    lens_cnts[part->chain_buf.buf[idx]]++;
+  }
+
+  int pre = 0;
+
+  while ((pre < cnt) && lens_cnts[rev[pre]])
+  {
+    lens_cnts[rev[pre]]--;
+
+    pre++;
+  }
+
+  for (int idx = pre; idx >= 0; idx--)
+  {
+    if (idx < pre) lens_cnts[rev[idx]]++;
+
+    if (idx == cnt) continue;
+
+    for (int elem_len = rev[idx] - 1; elem_len >= IN_LEN_MIN; elem_len--)
+    {
+      if (lens_cnts[elem_len] == 0) continue;
+
+      lens_cnts[elem_len]--;
+
+      memcpy (part->rev, rev, idx);
+
+      int pos = idx;
+
+      part->rev[pos++] = elem_len;
+
+      for (int len = IN_LEN_MAX; len >= IN_LEN_MIN; len--)
+      {
+        for (int run = 0; run < lens_cnts[len]; run++) part->rev[pos++] = len;
+      }
+
+      part->mask = part_mask (part);
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static u64 grp_sub_cnt (u8 *lens_buf, const int *live_buf, const int live_cnt, const int elem_len)
+{
+  // orderings of the live parts which continue with an element of elem_len
+
+  u64 sub_cnt = 0;
+
+  for (int live_idx = 0; live_idx < live_cnt; live_idx++)
+  {
+    u8 *lens_cnts = &lens_buf[live_buf[live_idx] * (IN_LEN_MAX + 1)];
+
+    if (lens_cnts[elem_len] == 0) continue;
+
+    lens_cnts[elem_len]--;
+
+    sub_cnt += elem_lens_perms_cnt (lens_cnts);
+
+    lens_cnts[elem_len]++;
+  }
+
+  return sub_cnt;
+}
+
+static int grp_live_take (u8 *lens_buf, int *live_buf, const int live_cnt, const int elem_len)
+{
+  // keep the live parts which have an element of elem_len left and use it up
+
+  int keep_cnt = 0;
+
+  for (int live_idx = 0; live_idx < live_cnt; live_idx++)
+  {
+    u8 *lens_cnts = &lens_buf[live_buf[live_idx] * (IN_LEN_MAX + 1)];
+
+    if (lens_cnts[elem_len] == 0) continue;
+
+    lens_cnts[elem_len]--;
+
+    live_buf[keep_cnt++] = live_buf[live_idx];
+  }
+
+  return keep_cnt;
+}
+
+static int grp_live_init (const db_entry_t *db_entry, const grp_t *grp, u8 **lens_buf, int **live_buf)
+{
+  // the element length counts of all parts of a keyspace group, all of them live
+
+  const int parts_cnt = grp->parts_end - grp->parts_beg;
+
+  *lens_buf = (u8 *)  calloc (parts_cnt, IN_LEN_MAX + 1);
+  *live_buf = (int *) malloc (parts_cnt * sizeof (int));
+
+  for (int live_idx = 0; live_idx < parts_cnt; live_idx++)
+  {
+    const chain_t *chain_buf = &db_entry->parts_buf[grp->parts_beg + live_idx].chain_buf;
+
+    for (int idx = 0; idx < chain_buf->cnt; idx++)
+    {
+      (*lens_buf)[live_idx * (IN_LEN_MAX + 1) + chain_buf->buf[idx]]++;
+    }
+
+    (*live_buf)[live_idx] = live_idx;
+  }
+
+  return parts_cnt;
+}
+
+static int chain_src_unrank (const db_entry_t *db_entry, u64 rank, u8 rev[CHAIN_ELEMS_MAX])
+{
+  // build the ordering at position rank of the current keyspace group, returns the part it belongs to
+
+  const grp_t *grp = &db_entry->grps_buf[db_entry->grps_pos];
+
+  u8  *lens_buf;
+  int *live_buf;
+
+  int live_cnt = grp_live_init (db_entry, grp, &lens_buf, &live_buf);
+
+  int len_left = 0;
+
+  for (int idx = 0; idx < db_entry->parts_buf[grp->parts_beg].chain_buf.cnt; idx++)
+  {
+    len_left += db_entry->parts_buf[grp->parts_beg].chain_buf.buf[idx];
+  }
+
+  int cnt = 0;
+
+  while (len_left)
+  {
+    // longer elements first, they have the lower masks
+
+    int elem_len;
+
+    for (elem_len = MIN (len_left, IN_LEN_MAX); elem_len > IN_LEN_MIN; elem_len--)
+    {
+      const u64 sub_cnt = grp_sub_cnt (lens_buf, live_buf, live_cnt, elem_len);
+
+      if (rank < sub_cnt) break;
+
+      rank -= sub_cnt;
+    }
+
+    rev[cnt++] = elem_len;
+
+    len_left -= elem_len;
+
+    live_cnt = grp_live_take (lens_buf, live_buf, live_cnt, elem_len);
+  }
+
+  const int parts_idx = grp->parts_beg + live_buf[0];
+
+  free (lens_buf);
+  free (live_buf);
+
+  return parts_idx;
+}
+
+static u64 chain_src_rank (const db_entry_t *db_entry, const grp_t *grp, const u8 *rev, const int cnt)
+{
+  // the position of an ordering inside its keyspace group, the inverse of chain_src_unrank ()
+
+  u8  *lens_buf;
+  int *live_buf;
+
+  int live_cnt = grp_live_init (db_entry, grp, &lens_buf, &live_buf);
+
+  int len_left = 0;
+
+  for (int idx = 0; idx < cnt; idx++) len_left += rev[idx];
+
+  u64 rank = 0;
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    for (int elem_len = MIN (len_left, IN_LEN_MAX); elem_len > rev[idx]; elem_len--)
+    {
+      rank += grp_sub_cnt (lens_buf, live_buf, live_cnt, elem_len);
+    }
+
+    len_left -= rev[idx];
+
+    live_cnt = grp_live_take (lens_buf, live_buf, live_cnt, rev[idx]);
+  }
+
+  free (lens_buf);
+  free (live_buf);
+
+  return rank;
+}
+
+static void chain_src_seek (db_entry_t *db_entry, const db_entry_t *db_entries, const mpz_t ks_pos, mpz_t tmp)
+{
+  // binary search the keyspace group, then unrank the chain inside of it
+
+  db_entry->heap_cnt = 0;
+
+  mpz_set_si (db_entry->chain_ks_pos, 0);
+
+  memset (db_entry->cur_chain_ks_poses, 0, CHAIN_ELEMS_MAX * sizeof (u64));
+
+  if (db_entry->grps_cnt == 0) return;
+
+  int lo = 0;
+  int hi = db_entry->grps_cnt - 1;
+
+  while (lo < hi)
+  {
+    const int mid = (lo + hi + 1) / 2;
+
+    if (mpz_cmp (db_entry->grps_buf[mid].ks_beg, ks_pos) <= 0)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+
+  const grp_t *grp = &db_entry->grps_buf[lo];
+
+  const part_t *part = &db_entry->parts_buf[grp->parts_beg];
+
+  db_entry->grps_pos = lo;
+
+  mpz_sub (tmp, ks_pos, grp->ks_beg);
+
+  mpz_tdiv_qr (tmp, db_entry->chain_ks_pos, tmp, part->ks_cnt);
+
+  const u64 rank = mpz_get_ui (tmp);
+
+  if (rank >= grp->chains_cnt)
+  {
+    // behind the last chain, the length is exhausted
+
+    mpz_set_si (db_entry->chain_ks_pos, 0);
+
+    db_entry->chains_pos = db_entry->chains_cnt;
+
+    return;
+  }
+
+  u8 rev[CHAIN_ELEMS_MAX];
+
+  const int parts_idx = chain_src_unrank (db_entry, rank, rev);
+
+  const int cnt = db_entry->parts_buf[parts_idx].chain_buf.cnt;
+
+  for (int idx = grp->parts_beg; idx < grp->parts_end; idx++)
+  {
+    if (idx == parts_idx) continue;
+
+    if (part_seek (&db_entry->parts_buf[idx], rev, cnt))
+    {
+      parts_heap_push (db_entry, idx);
+    }
+  }
+
+  part_t *cur = &db_entry->parts_buf[parts_idx];
+
+  memcpy (cur->rev, rev, cnt);
+
+  cur->mask = part_mask (cur);
+
+  chain_src_set (db_entry, parts_idx);
+
+  db_entry->chains_pos     = grp->chains_beg + rank;
+  db_entry->grp_chains_pos = rank;
+
+  mpz_set (tmp, db_entry->chain_ks_pos);
+
+  set_chain_ks_poses (&db_entry->chain_buf, db_entries, tmp, db_entry->cur_chain_ks_poses);
+}
+
+static void chain_valid_add (const chain_t *chain_buf, const db_entry_t *db_entries, const int req_mask, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], u64 add)
+{
+  // short distances walk the runs, long ones go through the rank
+
+  const int cnt = chain_buf->cnt;
+
+  u32 cover[CHAIN_ELEMS_MAX + 1];
+
+  chain_cover (chain_buf, db_entries, req_mask, cover);
+
+  for (int steps = 0; add; steps++)
+  {
+    if (steps == REQ_STEPS_MAX)
+    {
+      mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS];
+
+      mpz_t rank; mpz_init (rank);
+      mpz_t sub;  mpz_init (sub);
+
+      valid_tbl_init   (valid_tbl, cnt, req_mask);
+      chain_valid_tbl  (chain_buf, db_entries, req_mask, valid_tbl);
+      chain_valid_rank (chain_buf, db_entries, req_mask, valid_tbl, cur_chain_ks_poses, rank);
+
+      mpz_add_ui (rank, rank, add);
+
+      if (mpz_cmp (rank, valid_tbl[cnt][req_mask]) < 0)
+      {
+        chain_valid_unrank (chain_buf, db_entries, req_mask, valid_tbl, rank, sub, cur_chain_ks_poses);
+      }
+
+      valid_tbl_clear (valid_tbl, cnt, req_mask);
+
+      mpz_clear (rank);
+      mpz_clear (sub);
+
+      return;
+    }
+
+    const u64 run_end = chain_valid_run_end (chain_buf, db_entries, req_mask, cur_chain_ks_poses);
+
+    const u64 run = run_end - cur_chain_ks_poses[0];
+
+    if (add < run)
+    {
+      cur_chain_ks_poses[0] += add;
+
+      return;
+    }
+
+    add -= run;
+
+    cur_chain_ks_poses[0] = run_end - 1;
+
+    if (chain_valid_next (chain_buf, db_entries, req_mask, cover, cur_chain_ks_poses, 0) == 0) return;
+  }
+}
+
+void chain_ks_poses_add (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], u64 add)
+{
+  const u8 *buf = chain_buf->buf;
+
+  const int cnt = chain_buf->cnt;
+
+  const int req_mask = db_entries[buf[0]].req_mask;
+
+  if (req_mask)
+  {
+    chain_valid_add (chain_buf, db_entries, req_mask, cur_chain_ks_poses, add);
+
+    return;
+  }
+
+  for (int idx = 0; idx < cnt; idx++)
+  {
+    if (add == 0) break;
+
+    const u8 db_key = buf[idx];
+
+    const db_entry_t *db_entry = &db_entries[db_key];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    u64 elems_idx = cur_chain_ks_poses[idx] + (add % elems_cnt);
+
+    add /= elems_cnt;
+
+    if (elems_idx >= elems_cnt)
+    {
+      elems_idx -= elems_cnt;
+
+      add++;
+    }
+
+    cur_chain_ks_poses[idx] = elems_idx;
+  }
+}
+
+/**
+ * Engine setup: engine_init (), fill db_entries with elements, optionally
+ * engine_dedup (), then engine_keyspace () and engine_chains (). After that
+ * engine_next () hands out the segments in output order from position 0 on,
+ * engine_seek () moves to any position.
+ */
+
+void engine_init (engine_t *engine, const int pw_min, const int pw_max, const int elem_cnt_min, const int elem_cnt_max, const int wl_dist_len, const int weighted, const int req_mask)
+{
+  memset (engine, 0, sizeof (engine_t));
+
+  engine->db_entries   = (db_entry_t *) calloc (OUT_LEN_MAX + 1, sizeof (db_entry_t));
+  engine->pw_orders    = (pw_order_t *) calloc (OUT_LEN_MAX + 1, sizeof (pw_order_t));
+  engine->wordlen_dist = (u64 *)        calloc (OUT_LEN_MAX + 1, sizeof (u64));
+
+  engine->pw_min       = pw_min;
+  engine->pw_max       = pw_max;
+  engine->elem_cnt_min = elem_cnt_min;
+  engine->elem_cnt_max = elem_cnt_max;
+  engine->wl_dist_len  = wl_dist_len;
+  engine->weighted     = weighted;
+  engine->req_mask     = req_mask;
+
+  for (int db_key = 0; db_key <= OUT_LEN_MAX; db_key++)
+  {
+    engine->db_entries[db_key].req_mask = req_mask;
+  }
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    mpz_init (engine->pw_ks_cnt[pw_len]);
+  }
+
+  mpz_init (engine->total_ks_cnt);
+  mpz_init (engine->total_ks_pos);
+  mpz_init (engine->total_ks_end);
+  mpz_init (engine->iter_max);
+  mpz_init (engine->tmp);
+}
+
+u64 engine_dedup (engine_t *engine, u64 elems_raw_cnts[IN_LEN_MAX + 1][CLASS_MASKS])
+{
+  const int req_mask = engine->req_mask;
+
+  u64 dupes_cnt = 0;
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    db_entry_t *db_entry = &engine->db_entries[input_len];
+
+    memset (elems_raw_cnts[input_len], 0, CLASS_MASKS * sizeof (u64));
+
+    if (req_mask)
+    {
+      for (u64 elems_idx = 0; elems_idx < db_entry->elems_cnt; elems_idx++)
+      {
+        elems_raw_cnts[input_len][elem_mask (&db_entry->elems_buf[elems_idx], input_len) & req_mask]++;
+      }
+    }
+    else
+    {
+      elems_raw_cnts[input_len][0] = db_entry->elems_cnt;
+    }
+
+    dupes_cnt += elems_dedup (db_entry);
+  }
+
+  return dupes_cnt;
+}
+
+static void engine_phase (const engine_t *engine, const char *phase)
+{
+  if (engine->phase_cb) engine->phase_cb (engine->phase_ctx, phase);
+}
+
+void engine_keyspace (engine_t *engine)
+{
+  u64 elems_cnts[IN_LEN_MAX + 1][CLASS_MASKS] = {{ 0 }};
+
+  if (engine->elems_mapped == 0)
+  {
+    for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+    {
+      elems_sort (&engine->db_entries[input_len], input_len);
+    }
+  }
+
+  engine_phase (engine, "elems sort");
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    db_entry_t *db_entry = &engine->db_entries[input_len];
+
+    for (int mask = 0; mask < CLASS_MASKS; mask++)
+    {
+      elems_cnts[input_len][mask] = db_entry->masks_offs[mask + 1] - db_entry->masks_offs[mask];
+    }
+  }
+
+  keyspace_calc (elems_cnts, engine->req_mask, engine->pw_min, engine->pw_max, engine->elem_cnt_min, engine->elem_cnt_max, engine->pw_ks_cnt, engine->total_ks_cnt);
+
+  mpz_set (engine->total_ks_end, engine->total_ks_cnt);
+
+  engine_phase (engine, "keyspace");
+}
+
+static void engine_weights (engine_t *engine)
+{
+  // the probability of an element is its count over all counts, independent of its position
+
+  db_entry_t *db_entries   = engine->db_entries;
+  u64        *wordlen_dist = engine->wordlen_dist;
+
+  const int pw_min = engine->pw_min;
+  const int pw_max = engine->pw_max;
+
+  double lens_mass[IN_LEN_MAX + 1] = { 0 };
+  double elems_prob[IN_LEN_MAX + 1] = { 0 };
+
+  double total_mass = 0;
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    db_entry_t *db_entry = &db_entries[input_len];
+
+    for (u64 elems_idx = 0; elems_idx < db_entry->elems_cnt; elems_idx++)
+    {
+      lens_mass[input_len] += (double) db_entry->weights_buf[elems_idx];
+    }
+
+    total_mass += lens_mass[input_len];
+  }
+
+  if (total_mass == 0) total_mass = 1;
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    const u64 elems_cnt = db_entries[input_len].elems_cnt;
+
+    lens_mass[input_len] /= total_mass;
+
+    if (elems_cnt) elems_prob[input_len] = lens_mass[input_len] / elems_cnt;
+  }
+
+  // a chain is scored by the average probability of its candidates
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    db_entry_t *db_entry = &db_entries[pw_len];
+
+    for (int parts_idx = 0; parts_idx < db_entry->parts_cnt; parts_idx++)
+    {
+      part_t *part = &db_entry->parts_buf[parts_idx];
+
+      double score = 1;
+
+      for (int idx = 0; idx < part->chain_buf.cnt; idx++)
+      {
+        score *= elems_prob[part->chain_buf.buf[idx]];
+      }
+
+      part->score = score;
+    }
+  }
+
+  // the probability mass of each output length, same recursion as keyspace_calc ()
+
+  double mass_tbl[OUT_LEN_MAX + 1][CHAIN_ELEMS_MAX + 1];
+
+  memset (mass_tbl, 0, sizeof (mass_tbl));
+
+  mass_tbl[0][0] = 1;
+
+  for (int len = 1; len <= pw_max; len++)
+  {
+    for (int cnt = 1; cnt <= engine->elem_cnt_max; cnt++)
+    {
+      for (int elem_len = IN_LEN_MIN; elem_len <= MIN (len, IN_LEN_MAX); elem_len++)
+      {
+        mass_tbl[len][cnt] += mass_tbl[len - elem_len][cnt - 1] * lens_mass[elem_len];
+      }
+    }
+  }
+
+  double pw_mass[OUT_LEN_MAX + 1] = { 0 };
+
+  double pw_mass_sum = 0;
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    for (int cnt = engine->elem_cnt_min; cnt <= engine->elem_cnt_max; cnt++)
+    {
+      pw_mass[pw_len] += mass_tbl[pw_len][cnt];
+    }
+
+    pw_mass_sum += pw_mass[pw_len];
+  }
+
+  if (pw_mass_sum == 0) pw_mass_sum = 1;
+
+  for (int pw_len = IN_LEN_MIN; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    wordlen_dist[pw_len] = (u64) (pw_mass[pw_len] / pw_mass_sum * WL_DIST_SCALE + 0.5);
+
+    if (wordlen_dist[pw_len] == 0) wordlen_dist[pw_len] = 1;
+  }
+}
+
+/**
+ * Native positions, as long as the keyspace fits into 128 bit engine_next ()
+ * does not need to touch mpz_t at all
+ */
+
+#ifdef ENGINE_U128
+
+static u128 mpz_get_u128 (const mpz_t op)
+{
+  u64 words[2] = { 0, 0 };
+
+  mpz_export (words, NULL, -1, sizeof (u64), 0, 0, op);
+
+  return ((u128) words[1] << 64) | words[0];
+}
+
+static void mpz_set_u128 (mpz_t rop, const u128 op)
+{
+  const u64 words[2] = { (u64) op, (u64) (op >> 64) };
+
+  mpz_import (rop, 2, -1, sizeof (u64), 0, 0, words);
+}
+
+static int mpz_fits_u128 (const mpz_t op)
+{
+  return (mpz_sgn (op) >= 0) && (mpz_sizeinbase (op, 2) <= 128);
+}
+
+#endif
+
+static void engine_native_load (engine_t *engine)
+{
+  engine->native = 0;
+
+  #ifdef ENGINE_U128
+
+  if (mpz_fits_u128 (engine->total_ks_cnt) == 0) return;
+  if (mpz_fits_u128 (engine->total_ks_end) == 0) return;
+
+  for (int pw_len = engine->pw_min; pw_len <= engine->pw_max; pw_len++)
+  {
+    db_entry_t *db_entry = &engine->db_entries[pw_len];
+
+    for (int parts_idx = 0; parts_idx < db_entry->parts_cnt; parts_idx++)
+    {
+      part_t *part = &db_entry->parts_buf[parts_idx];
+
+      part->ks_cnt_n = mpz_get_u128 (part->ks_cnt);
+    }
+
+    db_entry->chain_ks_pos_n = mpz_get_u128 (db_entry->chain_ks_pos);
+  }
+
+  engine->total_ks_pos_n = mpz_get_u128 (engine->total_ks_pos);
+  engine->total_ks_end_n = mpz_get_u128 (engine->total_ks_end);
+
+  engine->native = 1;
+
+  #endif
+}
+
+static void engine_native_sync (engine_t *engine)
+{
+  // back to the mpz_t positions, for the code which only knows those, total_ks_end is never
+  // changed natively
+
+  if (engine->native == 0) return;
+
+  #ifdef ENGINE_U128
+
+  for (int pw_len = engine->pw_min; pw_len <= engine->pw_max; pw_len++)
+  {
+    db_entry_t *db_entry = &engine->db_entries[pw_len];
+
+    mpz_set_u128 (db_entry->chain_ks_pos, db_entry->chain_ks_pos_n);
+  }
+
+  mpz_set_u128 (engine->total_ks_pos, engine->total_ks_pos_n);
+
+  #endif
+
+  engine->native = 0;
+}
+
+void engine_pos_get (const engine_t *engine, mpz_t ks_pos)
+{
+  #ifdef ENGINE_U128
+
+  if (engine->native)
+  {
+    mpz_set_u128 (ks_pos, engine->total_ks_pos_n);
+
+    return;
+  }
+
+  #endif
+
+  mpz_set (ks_pos, engine->total_ks_pos);
+}
+
+void engine_end_set (engine_t *engine, const mpz_t ks_end)
+{
+  engine_native_sync (engine);
+
+  mpz_set (engine->total_ks_end, ks_end);
+
+  engine_native_load (engine);
+}
+
+void engine_chains (engine_t *engine)
+{
+  db_entry_t *db_entries   = engine->db_entries;
+  pw_order_t *pw_orders    = engine->pw_orders;
+  u64        *wordlen_dist = engine->wordlen_dist;
+
+  const int pw_min = engine->pw_min;
+  const int pw_max = engine->pw_max;
+
+  /**
+   * init chains
+   */
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    db_entry_t *db_entry = &db_entries[pw_len];
+
+    // only partitions into lengths which exist, so no need to check the chains later
+
+    chain_t chain_buf_new;
+
+    chain_buf_new.cnt = 0;
+
+    parts_gen (db_entry, db_entries, &chain_buf_new, pw_len, IN_LEN_MAX, engine->elem_cnt_min, engine->elem_cnt_max);
+
+    db_entry->chains_cnt = 0;
+
+    for (int parts_idx = 0; parts_idx < db_entry->parts_cnt; parts_idx++)
+    {
+      db_entry->chains_cnt += db_entry->parts_buf[parts_idx].perms_cnt;
+    }
+
+    db_entry->heap_buf = (int *) malloc ((db_entry->parts_cnt + 1) * sizeof (int));
+
+    mpz_init_set_si (db_entry->chain_ks_pos, 0);
+
+    memset (db_entry->cur_chain_ks_poses, 0, CHAIN_ELEMS_MAX * sizeof (u64));
+  }
+
+  /**
+   * calculate password candidate output length distribution
+   */
+
+  if (engine->weighted)
+  {
+    engine_weights (engine);
+  }
+  else if (engine->wl_dist_len)
+  {
+    for (int pw_len = IN_LEN_MIN; pw_len <= OUT_LEN_MAX; pw_len++)
+    {
+      db_entry_t *db_entry = &db_entries[pw_len];
+
+      wordlen_dist[pw_len] = db_entry->elems_cnt;
+
+      // lengths without words can still have chains, they would never be scheduled
+
+      if (wordlen_dist[pw_len] == 0) wordlen_dist[pw_len] = 1;
+    }
+  }
+  else
+  {
+    for (int pw_len = IN_LEN_MIN; pw_len <= OUT_LEN_MAX; pw_len++)
+    {
+      if (pw_len < DEF_WORDLEN_DIST_CNT)
+      {
+        wordlen_dist[pw_len] = DEF_WORDLEN_DIST[pw_len];
+      }
+      else
+      {
+        wordlen_dist[pw_len] = 1;
+      }
+    }
+  }
+
+  engine_phase (engine, "chains init");
+
+  /**
+   * sort chains by ks, or by probability with weighted input
+   */
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    db_entry_t *db_entry = &db_entries[pw_len];
+
+    part_t *parts_buf = db_entry->parts_buf;
+
+    const int parts_cnt = db_entry->parts_cnt;
+
+    qsort (parts_buf, parts_cnt, sizeof (part_t), (engine->weighted) ? sort_by_score : sort_by_ks);
+
+    chain_src_init (db_entry);
+
+    if (parts_cnt) chain_ks_poses_first (&db_entry->chain_buf, db_entries, db_entry->cur_chain_ks_poses);
+  }
+
+  engine_phase (engine, "chains sort");
+
+  /**
+   * sort global order by password length counts
+   */
+
+  for (int pw_len = pw_min, order_pos = 0; pw_len <= pw_max; pw_len++, order_pos++)
+  {
+    db_entry_t *db_entry = &db_entries[pw_len];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    pw_order_t *pw_order = &pw_orders[order_pos];
+
+    pw_order->len = pw_len;
+    pw_order->cnt = (engine->weighted) ? wordlen_dist[pw_len] : elems_cnt;
+  }
+
+  engine->order_cnt = pw_max + 1 - pw_min;
+
+  qsort (pw_orders, engine->order_cnt, sizeof (pw_order_t), sort_by_cnt);
+
+  engine->order_pos = 0;
+  engine->outs_pos  = 0;
+
+  mpz_set_si (engine->total_ks_pos, 0);
+
+  engine_native_load (engine);
+
+  engine_phase (engine, "orders sort");
+}
+
+void engine_seek (engine_t *engine, const mpz_t ks_pos)
+{
+  db_entry_t *db_entries   = engine->db_entries;
+  u64        *wordlen_dist = engine->wordlen_dist;
+
+  const int pw_min = engine->pw_min;
+  const int pw_max = engine->pw_max;
+
+  mpz_ptr tmp = engine->tmp;
+
+  mpz_t pw_ks_pos[OUT_LEN_MAX + 1];
+
+  engine_native_sync (engine);
+
+  // every length moves by wordlen_dist[] per main loop until it runs dry, so the keyspace done after
+  // some main loops is linear in between the main loops where a length runs dry
+
+  int lens_buf[OUT_LEN_MAX + 1];
+  int lens_cnt = 0;
+
+  mpz_t loops_end[OUT_LEN_MAX + 1];
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    mpz_init_set_si (pw_ks_pos[pw_len], 0);
+
+    mpz_init (loops_end[pw_len]);
+
+    mpz_cdiv_q_ui (loops_end[pw_len], engine->pw_ks_cnt[pw_len], wordlen_dist[pw_len]);
+
+    int pos = lens_cnt++;
+
+    for (; pos > 0 && mpz_cmp (loops_end[lens_buf[pos - 1]], loops_end[pw_len]) > 0; pos--)
+    {
+      lens_buf[pos] = lens_buf[pos - 1];
+    }
+
+    lens_buf[pos] = pw_len;
+  }
+
+  // prefix sums of the lengths ran dry and the distribution of the remaining ones
+
+  mpz_t ks_done[OUT_LEN_MAX + 1];
+
+  u64 dist_left[OUT_LEN_MAX + 1];
+
+  mpz_init_set_si (ks_done[0], 0);
+
+  for (int idx = 1; idx < lens_cnt; idx++)
+  {
+    mpz_init (ks_done[idx]);
+
+    mpz_add (ks_done[idx], ks_done[idx - 1], engine->pw_ks_cnt[lens_buf[idx - 1]]);
+  }
+
+  dist_left[lens_cnt - 1] = wordlen_dist[lens_buf[lens_cnt - 1]];
+
+  for (int idx = lens_cnt - 2; idx >= 0; idx--)
+  {
+    dist_left[idx] = dist_left[idx + 1] + wordlen_dist[lens_buf[idx]];
+  }
+
+  // find the last piece starting at or before ks_pos
+
+  int lo = 0;
+  int hi = lens_cnt - 1;
+
+  while (lo < hi)
+  {
+    const int mid = (lo + hi + 1) / 2;
+
+    mpz_mul_ui (tmp, loops_end[lens_buf[mid - 1]], dist_left[mid]);
+
+    mpz_add (tmp, tmp, ks_done[mid]);
+
+    if (mpz_cmp (tmp, ks_pos) <= 0)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid - 1;
+    }
+  }
+
+  mpz_t main_loops; mpz_init (main_loops);
+
+  mpz_sub (main_loops, ks_pos, ks_done[lo]);
+
+  mpz_fdiv_q_ui (main_loops, main_loops, dist_left[lo]);
+
+  for (int idx = 0; idx < lens_cnt; idx++)
+  {
+    const int pw_len = lens_buf[idx];
+
+    if (idx < lo)
+    {
+      mpz_set (pw_ks_pos[pw_len], engine->pw_ks_cnt[pw_len]);
+    }
+    else
+    {
+      mpz_mul_ui (pw_ks_pos[pw_len], main_loops, wordlen_dist[pw_len]);
+    }
+  }
+
+  mpz_mul_ui (engine->total_ks_pos, main_loops, dist_left[lo]);
+
+  mpz_add (engine->total_ks_pos, engine->total_ks_pos, ks_done[lo]);
+
+  // set db_entries to pw_ks_pos[], the main loop starts over
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    chain_src_seek (&db_entries[pw_len], db_entries, pw_ks_pos[pw_len], tmp);
+  }
+
+  engine->order_pos = 0;
+  engine->outs_pos  = 0;
+
+  // clean up
+
+  for (int idx = 0; idx < lens_cnt; idx++)
+  {
+    mpz_clear (ks_done[idx]);
+  }
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    mpz_clear (pw_ks_pos[pw_len]);
+    mpz_clear (loops_end[pw_len]);
+  }
+
+  mpz_clear (main_loops);
+
+  // the rest is less than one main loop, walk it
+
+  seg_t seg;
+
+  while (mpz_cmp (engine->total_ks_pos, ks_pos) < 0)
+  {
+    mpz_sub (tmp, ks_pos, engine->total_ks_pos);
+
+    if (engine_next (engine, &seg, mpz_get_ui (tmp)) == 0) break;
+  }
+
+  engine_native_load (engine);
+}
+
+/**
+ * Rank: every split of a candidate into elements which exist is a chain of
+ * its length. The position inside the length is the keyspace group of the
+ * part of the chain, the ordering inside the group and the elements inside
+ * the chain, the main loop then maps it to the global position.
+ */
+
+typedef struct
+{
+  u64  *idxs_buf;
+  u64   idxs_cnt;
+  u64   idxs_alloc;
+
+} rank_elems_t;
+
+typedef struct
+{
+  const engine_t *engine;
+
+  const u8       *pw_buf;
+  int             pw_len;
+
+  // the elements equal to the substring at [offset][length]
+
+  rank_elems_t    matches[OUT_LEN_MAX][IN_LEN_MAX + 1];
+
+  chain_t         chain_buf;
+
+  rank_t         *ranks_buf;
+  u64             ranks_cnt;
+  u64             ranks_alloc;
+
+  mpz_t           len_pos;
+  mpz_t           loops;
+  mpz_t           tmp;
+
+} rank_ctx_t;
+
+static int sort_by_ks_pos (const void *p1, const void *p2)
+{
+  const rank_t *r1 = (const rank_t *) p1;
+  const rank_t *r2 = (const rank_t *) p2;
+
+  return mpz_cmp (r1->ks_pos, r2->ks_pos);
+}
+
+static void rank_matches (rank_ctx_t *ctx)
+{
+  const db_entry_t *db_entries = ctx->engine->db_entries;
+
+  const u8 *pw_buf = ctx->pw_buf;
+
+  const int pw_len = ctx->pw_len;
+
+  for (int elem_len = IN_LEN_MIN; elem_len <= MIN (pw_len, IN_LEN_MAX); elem_len++)
+  {
+    const db_entry_t *db_entry = &db_entries[elem_len];
+
+    for (u64 elems_idx = 0; elems_idx < db_entry->elems_cnt; elems_idx++)
+    {
+      const u8 *elem_buf = db_entry->elems_buf[elems_idx].buf;
+
+      for (int off = 0; off + elem_len <= pw_len; off++)
+      {
+        if (elem_buf[0] != pw_buf[off]) continue;
+
+        if (memcmp (elem_buf, pw_buf + off, elem_len)) continue;
+
+        rank_elems_t *match = &ctx->matches[off][elem_len];
+
+        if (match->idxs_cnt == match->idxs_alloc)
+        {
+          match->idxs_alloc += ALLOC_NEW_PARTS;
+
+          match->idxs_buf = (u64 *) realloc (match->idxs_buf, match->idxs_alloc * sizeof (u64));
+
+          if (match->idxs_buf == NULL)
+          {
+            fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) match->idxs_alloc * sizeof (u64));
+
+            exit (-1);
+          }
+        }
+
+        match->idxs_buf[match->idxs_cnt++] = elems_idx;
+      }
+    }
+  }
+}
+
+static void rank_len_pos (const engine_t *engine, const int pw_len, const mpz_t len_pos, mpz_t ks_pos, mpz_t loops, mpz_t tmp)
+{
+  // the main loop takes up to wordlen_dist[] candidates of each length per turn, in pw_orders[] order
+
+  const u64 *wordlen_dist = engine->wordlen_dist;
+
+  mpz_set_ui (ks_pos, mpz_fdiv_q_ui (loops, len_pos, wordlen_dist[pw_len]));
+
+  int front = 1;
+
+  for (int order_pos = 0; order_pos < engine->order_cnt; order_pos++)
+  {
+    const int len = engine->pw_orders[order_pos].len;
+
+    if (len == pw_len) front = 0;
+
+    // the turns before
+
+    mpz_mul_ui (tmp, loops, wordlen_dist[len]);
+
+    if (mpz_cmp (tmp, engine->pw_ks_cnt[len]) >= 0)
+    {
+      mpz_add (ks_pos, ks_pos, engine->pw_ks_cnt[len]);
+
+      continue;
+    }
+
+    mpz_add (ks_pos, ks_pos, tmp);
+
+    // the lengths in front of pw_len in this turn
+
+    if (front == 0) continue;
+
+    mpz_sub (tmp, engine->pw_ks_cnt[len], tmp);
+
+    if (mpz_cmp_ui (tmp, wordlen_dist[len]) > 0) mpz_set_ui (tmp, wordlen_dist[len]);
+
+    mpz_add (ks_pos, ks_pos, tmp);
+  }
+}
+
+static void rank_chain (rank_ctx_t *ctx)
+{
+  const engine_t *engine = ctx->engine;
+
+  const db_entry_t *db_entries = engine->db_entries;
+
+  const db_entry_t *db_entry = &db_entries[ctx->pw_len];
+
+  const chain_t *chain_buf = &ctx->chain_buf;
+
+  const int cnt = chain_buf->cnt;
+
+  // the part has the same element lengths in descending order, the ordering is reversed
+
+  u8 rev[CHAIN_ELEMS_MAX];
+
+  for (int idx = 0; idx < cnt; idx++) rev[idx] = chain_buf->buf[cnt - 1 - idx];
+
+  u8 lens[CHAIN_ELEMS_MAX];
+
+  memcpy (lens, chain_buf->buf, cnt);
+
+  for (int i = 1; i < cnt; i++)
+  {
+    for (int j = i; (j > 0) && (lens[j - 1] < lens[j]); j--)
+    {
+      const u8 t = lens[j]; lens[j] = lens[j - 1]; lens[j - 1] = t;
+    }
+  }
+
+  int parts_idx;
+
+  for (parts_idx = 0; parts_idx < db_entry->parts_cnt; parts_idx++)
+  {
+    const chain_t *part_chain = &db_entry->parts_buf[parts_idx].chain_buf;
+
+    if ((part_chain->cnt == cnt) && (memcmp (part_chain->buf, lens, cnt) == 0)) break;
+  }
+
+  // out of --elem-cnt-min/max or no candidate under the policy
+
+  if (parts_idx == db_entry->parts_cnt) return;
+
+  const part_t *part = &db_entry->parts_buf[parts_idx];
+
+  int grps_idx = 0;
+
+  while (db_entry->grps_buf[grps_idx].parts_end <= parts_idx) grps_idx++;
+
+  const grp_t *grp = &db_entry->grps_buf[grps_idx];
+
+  const u64 grp_rank = chain_src_rank (db_entry, grp, rev, cnt);
+
+  const int req_mask = engine->req_mask;
+
+  mpz_t valid_tbl[CHAIN_ELEMS_MAX + 1][CLASS_MASKS];
+
+  if (req_mask)
+  {
+    valid_tbl_init  (valid_tbl, cnt, req_mask);
+    chain_valid_tbl (chain_buf, db_entries, req_mask, valid_tbl);
+  }
+
+  // every combination of the matching elements
+
+  const rank_elems_t *matches[CHAIN_ELEMS_MAX];
+
+  for (int idx = 0, off = 0; idx < cnt; off += chain_buf->buf[idx], idx++)
+  {
+    matches[idx] = &ctx->matches[off][chain_buf->buf[idx]];
+  }
+
+  u64 digits[CHAIN_ELEMS_MAX] = { 0 };
+
+  while (1)
+  {
+    if (ctx->ranks_cnt == ctx->ranks_alloc)
+    {
+      ctx->ranks_alloc += ALLOC_NEW_PARTS;
+
+      ctx->ranks_buf = (rank_t *) realloc (ctx->ranks_buf, ctx->ranks_alloc * sizeof (rank_t));
+
+      if (ctx->ranks_buf == NULL)
+      {
+        fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) ctx->ranks_alloc * sizeof (rank_t));
+
+        exit (-1);
+      }
+    }
+
+    rank_t *rank = &ctx->ranks_buf[ctx->ranks_cnt++];
+
+    rank->pw_len    = ctx->pw_len;
+    rank->chain_pos = grp->chains_beg + grp_rank;
+    rank->chain_buf = *chain_buf;
+
+    for (int idx = 0; idx < cnt; idx++) rank->elems_idxs[idx] = matches[idx]->idxs_buf[digits[idx]];
+
+    // inside the chain the first element varies fastest
+
+    if (req_mask)
+    {
+      chain_valid_rank (chain_buf, db_entries, req_mask, valid_tbl, rank->elems_idxs, ctx->len_pos);
+    }
+    else
+    {
+      mpz_set_si (ctx->len_pos, 0);
+
+      for (int idx = cnt - 1; idx >= 0; idx--)
+      {
+        mpz_mul_ui (ctx->len_pos, ctx->len_pos, db_entries[chain_buf->buf[idx]].elems_cnt);
+        mpz_add_ui (ctx->len_pos, ctx->len_pos, rank->elems_idxs[idx]);
+      }
+    }
+
+    mpz_addmul_ui (ctx->len_pos, part->ks_cnt, grp_rank);
+
+    mpz_add (ctx->len_pos, ctx->len_pos, grp->ks_beg);
+
+    mpz_init (rank->ks_pos);
+
+    rank_len_pos (engine, ctx->pw_len, ctx->len_pos, rank->ks_pos, ctx->loops, ctx->tmp);
+
+    int idx;
+
+    for (idx = 0; idx < cnt; idx++)
+    {
+      if (++digits[idx] < matches[idx]->idxs_cnt) break;
+
+      digits[idx] = 0;
+    }
+
+    if (idx == cnt) break;
+  }
+
+  if (req_mask) valid_tbl_clear (valid_tbl, cnt, req_mask);
+}
+
+static void rank_split (rank_ctx_t *ctx, const int off)
+{
+  if (off == ctx->pw_len)
+  {
+    rank_chain (ctx);
+
+    return;
+  }
+
+  chain_t *chain_buf = &ctx->chain_buf;
+
+  if (chain_buf->cnt == ctx->engine->elem_cnt_max) return;
+
+  for (int elem_len = IN_LEN_MIN; elem_len <= MIN (ctx->pw_len - off, IN_LEN_MAX); elem_len++)
+  {
+    if (ctx->matches[off][elem_len].idxs_cnt == 0) continue;
+
+    chain_buf->buf[chain_buf->cnt++] = elem_len;
+
+    rank_split (ctx, off + elem_len);
+
+    chain_buf->cnt--;
+  }
+}
+
+u64 engine_rank (const engine_t *engine, const char *pw_buf, const int pw_len, rank_t **ranks_buf)
+{
+  // all positions producing the candidate pw_buf, in ascending order
+
+  *ranks_buf = NULL;
+
+  if ((pw_len < engine->pw_min) || (pw_len > engine->pw_max)) return 0;
+
+  if ((buf_mask ((const u8 *) pw_buf, pw_len) & engine->req_mask) != engine->req_mask) return 0;
+
+  rank_ctx_t *ctx = (rank_ctx_t *) calloc (1, sizeof (rank_ctx_t));
+
+  ctx->engine = engine;
+  ctx->pw_buf = (const u8 *) pw_buf;
+  ctx->pw_len = pw_len;
+
+  mpz_init (ctx->len_pos);
+  mpz_init (ctx->loops);
+  mpz_init (ctx->tmp);
+
+  rank_matches (ctx);
+
+  rank_split (ctx, 0);
+
+  qsort (ctx->ranks_buf, ctx->ranks_cnt, sizeof (rank_t), sort_by_ks_pos);
+
+  for (int off = 0; off < pw_len; off++)
+  {
+    for (int elem_len = IN_LEN_MIN; elem_len <= IN_LEN_MAX; elem_len++)
+    {
+      free (ctx->matches[off][elem_len].idxs_buf);
+    }
+  }
+
+  mpz_clear (ctx->len_pos);
+  mpz_clear (ctx->loops);
+  mpz_clear (ctx->tmp);
+
+  *ranks_buf = ctx->ranks_buf;
+
+  const u64 ranks_cnt = ctx->ranks_cnt;
+
+  free (ctx);
+
+  return ranks_cnt;
+}
+
+void ranks_free (rank_t *ranks_buf, const u64 ranks_cnt)
+{
+  for (u64 ranks_idx = 0; ranks_idx < ranks_cnt; ranks_idx++)
+  {
+    mpz_clear (ranks_buf[ranks_idx].ks_pos);
+  }
+
+  free (ranks_buf);
+}
+
+int engine_peek (engine_t *engine)
+{
+  // move on to the next length with candidates left in this main loop, returns its length or 0 at the end
+
+  #ifdef ENGINE_U128
+
+  if (engine->native)
+  {
+    if (engine->total_ks_pos_n >= engine->total_ks_end_n) return 0;
+  }
+  else
+
+  #endif
+
+  if (mpz_cmp (engine->total_ks_pos, engine->total_ks_end) >= 0) return 0;
+
+  while (1)
+  {
+    if (engine->order_pos == engine->order_cnt) engine->order_pos = 0;
+
+    const int pw_len = engine->pw_orders[engine->order_pos].len;
+
+    const db_entry_t *db_entry = &engine->db_entries[pw_len];
+
+    if ((engine->outs_pos < engine->wordlen_dist[pw_len]) && (db_entry->chains_pos < db_entry->chains_cnt)) return pw_len;
+
+    engine->order_pos++;
+    engine->outs_pos = 0;
+  }
+}
+
+static u64 engine_next_mpz (engine_t *engine, db_entry_t *db_entry, const u64 outs_left, int *chain_done)
+{
+  mpz_srcptr chain_ks_cnt = db_entry->parts_buf[db_entry->chain_part].ks_cnt;
+
+  mpz_ptr chain_ks_pos = db_entry->chain_ks_pos;
+
+  mpz_ptr iter_max = engine->iter_max;
+  mpz_ptr tmp      = engine->tmp;
+
+  mpz_sub (tmp, engine->total_ks_end, engine->total_ks_pos);
+
+  mpz_sub (iter_max, chain_ks_cnt, chain_ks_pos);
+
+  if (mpz_cmp (tmp, iter_max) < 0)
+  {
+    mpz_set (iter_max, tmp);
+  }
+
+  if (mpz_cmp_ui (iter_max, outs_left) > 0)
+  {
+    mpz_set_ui (iter_max, outs_left);
+  }
+
+  const u64 iter_cnt = mpz_get_ui (iter_max);
+
+  mpz_add (engine->total_ks_pos, engine->total_ks_pos, iter_max);
+
+  mpz_add (chain_ks_pos, chain_ks_pos, iter_max);
+
+  *chain_done = (mpz_cmp (chain_ks_pos, chain_ks_cnt) == 0);
+
+  return iter_cnt;
+}
+
+int engine_next (engine_t *engine, seg_t *seg, const u64 iter_lim)
+{
+  const int pw_len = engine_peek (engine);
+
+  if (pw_len == 0) return 0;
+
+  db_entry_t *db_entries = engine->db_entries;
+
+  db_entry_t *db_entry = &db_entries[pw_len];
+
+  const u64 outs_left = MIN (engine->wordlen_dist[pw_len] - engine->outs_pos, iter_lim);
+
+  u64 iter_cnt;
+
+  int chain_done;
+
+  #ifdef ENGINE_U128
+
+  if (engine->native)
+  {
+    const u128 chain_ks_cnt = db_entry->parts_buf[db_entry->chain_part].ks_cnt_n;
+
+    u128 iter_max = chain_ks_cnt - db_entry->chain_ks_pos_n;
+
+    iter_max = MIN (iter_max, engine->total_ks_end_n - engine->total_ks_pos_n);
+    iter_max = MIN (iter_max, (u128) outs_left);
+
+    iter_cnt = (u64) iter_max;
+
+    engine->total_ks_pos_n += iter_max;
+
+    db_entry->chain_ks_pos_n += iter_max;
+
+    chain_done = (db_entry->chain_ks_pos_n == chain_ks_cnt);
+  }
+  else
+
+  #endif
+
+  {
+    iter_cnt = engine_next_mpz (engine, db_entry, outs_left, &chain_done);
+  }
+
+  seg->chain_buf = db_entry->chain_buf;
+  seg->pw_len    = pw_len;
+  seg->iter_cnt  = iter_cnt;
+
+  memcpy (seg->cur_chain_ks_poses, db_entry->cur_chain_ks_poses, CHAIN_ELEMS_MAX * sizeof (u64));
+
+  engine->outs_pos += iter_cnt;
+
+  if (chain_done)
+  {
+    chain_src_next (db_entry);
+
+    #ifdef ENGINE_U128
+    db_entry->chain_ks_pos_n = 0;
+    #endif
+
+    chain_ks_poses_first (&db_entry->chain_buf, db_entries, db_entry->cur_chain_ks_poses);
+  }
+  else
+  {
+    chain_ks_poses_add (&db_entry->chain_buf, db_entries, db_entry->cur_chain_ks_poses, iter_cnt);
+  }
+
+  return 1;
+}
+
+void engine_free (engine_t *engine)
+{
+  db_entry_t *db_entries = engine->db_entries;
+
+  for (int pw_len = IN_LEN_MIN; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    db_entry_t *db_entry = &db_entries[pw_len];
+
+    if (db_entry->parts_buf)
+    {
+      int     parts_cnt = db_entry->parts_cnt;
+      part_t *parts_buf = db_entry->parts_buf;
+
+      for (int parts_idx = 0; parts_idx < parts_cnt; parts_idx++)
+      {
+        part_t *part = &parts_buf[parts_idx];
+
+        mpz_clear (part->ks_cnt);
+      }
+
+      free (db_entry->parts_buf);
+    }
+
+    if (db_entry->grps_buf)
+    {
+      for (int grps_idx = 0; grps_idx < db_entry->grps_cnt; grps_idx++)
+      {
+        mpz_clear (db_entry->grps_buf[grps_idx].ks_beg);
+      }
+
+      free (db_entry->grps_buf);
+    }
+
+    if (db_entry->heap_buf)
+    {
+      free (db_entry->heap_buf);
+
+      mpz_clear (db_entry->chain_ks_pos);
+    }
+
+    if (engine->elems_mapped) continue;
+
+    if (db_entry->elems_buf) free (db_entry->elems_buf);
+
+    if (db_entry->weights_buf) free (db_entry->weights_buf);
+  }
+
+  for (int pw_len = engine->pw_min; pw_len <= engine->pw_max; pw_len++)
+  {
+    mpz_clear (engine->pw_ks_cnt[pw_len]);
+  }
+
+  mpz_clear (engine->total_ks_cnt);
+  mpz_clear (engine->total_ks_pos);
+  mpz_clear (engine->total_ks_end);
+  mpz_clear (engine->iter_max);
+  mpz_clear (engine->tmp);
+
+  free (engine->wordlen_dist);
+  free (engine->pw_orders);
+  free (db_entries);
+}
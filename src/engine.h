@@ -0,0 +1,271 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: PRINCE engine shared by pp and libprince
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+#include <stdint.h>
+#include <gmp.h>
+
+#define IN_LEN_MIN    1
+#define IN_LEN_MAX    16
+#define OUT_LEN_MAX   64
+#define PW_MIN        IN_LEN_MIN
+#define PW_MAX        16
+#define ELEM_CNT_MIN  1
+#define ELEM_CNT_MAX  8
+#define CHAIN_ELEMS_MAX 16
+#define THREADS_MAX   256
+
+#define CLASS_LOWER    1
+#define CLASS_UPPER    2
+#define CLASS_DIGIT    4
+#define CLASS_SPECIAL  8
+#define CLASS_MASKS    16
+
+#define ALLOC_NEW_ELEMS  0x40000
+#define WL_DIST_SCALE    1000000
+#define ALLOC_NEW_PARTS  0x10
+
+#define PW_BUF_SIZE   (((OUT_LEN_MAX + 1) + 15) & ~15)
+#define OUT_SLACK     (PW_BUF_SIZE * 2)
+
+#define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#if defined (__SIZEOF_INT128__)
+#define ENGINE_U128
+__extension__ typedef unsigned __int128 u128;
+#endif
+
+typedef struct
+{
+  int len;
+  u64 cnt;
+
+} pw_order_t;
+
+typedef struct
+{
+  u8    buf[IN_LEN_MAX];
+
+} elem_t;
+
+typedef struct
+{
+  u8    buf[CHAIN_ELEMS_MAX];
+  int   cnt;
+
+} chain_t;
+
+/**
+ * Chains are not materialized, there are too many of them for long
+ * passwords. A part_t is a partition of pw_len into element lengths, all
+ * orderings (chains) of it have the same keyspace. The parts of a length are
+ * sorted by keyspace, the orderings of all parts with the same keyspace are
+ * merged by their cut mask. That is the order the sorted chain table had.
+ */
+
+typedef struct
+{
+  chain_t chain_buf;
+  u8      rev[CHAIN_ELEMS_MAX];
+  u64     mask;
+  u64     perms_cnt;
+  double  score;
+
+  mpz_t   ks_cnt;
+
+  #ifdef ENGINE_U128
+  u128    ks_cnt_n;
+  #endif
+
+} part_t;
+
+typedef struct
+{
+  int     parts_beg;
+  int     parts_end;
+
+  u64     chains_beg;
+  u64     chains_cnt;
+
+  mpz_t   ks_beg;
+
+} grp_t;
+
+typedef struct
+{
+  elem_t  *elems_buf;
+  u64      elems_cnt;
+  u64      elems_alloc;
+
+  u64     *weights_buf;
+
+  // --require: the elements are sorted by their classes masked by req_mask,
+  // the ones of mask m are masks_offs[m] up to masks_offs[m + 1]
+
+  int      req_mask;
+  u64      masks_offs[CLASS_MASKS + 1];
+
+  part_t  *parts_buf;
+  int      parts_cnt;
+  int      parts_alloc;
+
+  int     *heap_buf;
+  int      heap_cnt;
+
+  grp_t   *grps_buf;
+  int      grps_cnt;
+  int      grps_pos;
+  u64      grp_chains_pos;
+
+  chain_t  chain_buf;
+  int      chain_part;
+  mpz_t    chain_ks_pos;
+
+  #ifdef ENGINE_U128
+  u128     chain_ks_pos_n;
+  #endif
+
+  u64      chains_cnt;
+  u64      chains_pos;
+
+  u64      cur_chain_ks_poses[CHAIN_ELEMS_MAX];
+
+} db_entry_t;
+
+/**
+ * A segment is a run of consecutive candidates of one chain, the unit the
+ * main loop hands out. It is self-contained so it can be rendered anywhere.
+ */
+
+typedef struct
+{
+  chain_t        chain_buf;
+  int            pw_len;
+  u64            iter_cnt;
+
+  u64            cur_chain_ks_poses[CHAIN_ELEMS_MAX];
+
+} seg_t;
+
+/**
+ * A position which produces a given candidate, see engine_rank (). The chain
+ * is the chains_pos of the length, the element indices are positions in the
+ * sorted elements of each length of the chain.
+ */
+
+typedef struct
+{
+  mpz_t          ks_pos;
+
+  int            pw_len;
+  u64            chain_pos;
+  chain_t        chain_buf;
+  u64            elems_idxs[CHAIN_ELEMS_MAX];
+
+} rank_t;
+
+/**
+ * The generator: the element database, the keyspace per length and the
+ * position of the main loop, which visits the lengths in pw_orders[] order
+ * and takes up to wordlen_dist[] candidates of each per turn.
+ *
+ * With weighted input (word<TAB>count) the elements of a length are sorted
+ * by count, the chains of a length by the average probability of their
+ * candidates and wordlen_dist[] is the probability mass of each length. The
+ * order is still fixed up front, so seeking works the same way.
+ *
+ * With a policy (req_mask) a chain only counts and emits the combinations of
+ * elements whose classes together cover req_mask.
+ *
+ * Positions: if the keyspace fits, engine_next () and engine_peek () work on
+ * the u128 copies (native) and the mpz_t positions are only brought up to
+ * date for engine_seek (). Read the position with engine_pos_get () and set
+ * total_ks_end with engine_end_set () only.
+ *
+ * With elems_mapped the elements come sorted from a --db-cache image which
+ * the caller owns, the engine neither sorts nor frees them.
+ */
+
+typedef struct
+{
+  db_entry_t *db_entries;
+  pw_order_t *pw_orders;
+  int         order_cnt;
+  u64        *wordlen_dist;
+
+  int         pw_min;
+  int         pw_max;
+  int         elem_cnt_min;
+  int         elem_cnt_max;
+  int         wl_dist_len;
+  int         weighted;
+  int         req_mask;
+  int         elems_mapped;
+
+  mpz_t       pw_ks_cnt[OUT_LEN_MAX + 1];
+  mpz_t       total_ks_cnt;
+  mpz_t       total_ks_pos;
+  mpz_t       total_ks_end;
+
+  int         order_pos;
+  u64         outs_pos;
+
+  int         native;
+
+  #ifdef ENGINE_U128
+  u128        total_ks_pos_n;
+  u128        total_ks_end_n;
+  #endif
+
+  mpz_t       iter_max;
+  mpz_t       tmp;
+
+  // called with the name of each phase of engine_keyspace () and
+  // engine_chains () when it is done, for --timings
+
+  void      (*phase_cb) (void *phase_ctx, const char *phase);
+  void       *phase_ctx;
+
+} engine_t;
+
+void check_realloc_elems (db_entry_t *db_entry, const int weighted);
+
+u64  wl_line_weight (const char *buf, u64 *len);
+int  wl_load_buf    (const char *wl_buf, const u64 wl_len, db_entry_t *db_entries, const int threads, const int weighted);
+
+u64  elem_hash   (const elem_t *elem_buf);
+u64  elems_dedup (db_entry_t *db_entry);
+
+void keyspace_calc (const u64 elems_cnts[IN_LEN_MAX + 1][CLASS_MASKS], const int req_mask, const int pw_min, const int pw_max, const int elem_cnt_min, const int elem_cnt_max, mpz_t *pw_ks_cnts, mpz_t total_ks_cnt);
+
+void chain_set_pwbuf_init (const chain_t *chain_buf, const db_entry_t *db_entries, const u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf);
+u64  chain_emit           (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf, const int rec_pre, const int rec_len, u64 iter_cnt, char *out_buf);
+void chain_ks_poses_add   (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], u64 add);
+
+void engine_init     (engine_t *engine, const int pw_min, const int pw_max, const int elem_cnt_min, const int elem_cnt_max, const int wl_dist_len, const int weighted, const int req_mask);
+u64  engine_dedup    (engine_t *engine, u64 elems_raw_cnts[IN_LEN_MAX + 1][CLASS_MASKS]);
+void engine_keyspace (engine_t *engine);
+void engine_chains   (engine_t *engine);
+void engine_seek     (engine_t *engine, const mpz_t ks_pos);
+void engine_pos_get  (const engine_t *engine, mpz_t ks_pos);
+void engine_end_set  (engine_t *engine, const mpz_t ks_end);
+u64  engine_rank     (const engine_t *engine, const char *pw_buf, const int pw_len, rank_t **ranks_buf);
+void ranks_free      (rank_t *ranks_buf, const u64 ranks_cnt);
+int  engine_peek     (engine_t *engine);
+int  engine_next     (engine_t *engine, seg_t *seg, const u64 iter_lim);
+void engine_free     (engine_t *engine);
+
+#endif // ENGINE_H
@@ -6,123 +6,391 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <fcntl.h>
 #include <time.h>
 #include <errno.h>
 #include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <gmp.h>
 
+#ifndef WINDOWS
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef LINUX
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
+
+#include "engine.h"
+#include "rules.h"
+
 /**
  * Name........: princeprocessor (pp)
  * Description.: Standalone password candidate generator using the PRINCE algorithm
- * Version.....: 0.19
+ * Version.....: 0.20
  * Autor.......: Jens Steube <jens.steube@gmail.com>
  * License.....: MIT
  */
 
-#define IN_LEN_MIN    1
-#define IN_LEN_MAX    16
-#define PW_MIN        IN_LEN_MIN
-#define PW_MAX        IN_LEN_MAX
-#define ELEM_CNT_MIN  1
-#define ELEM_CNT_MAX  8
 #define WL_DIST_LEN   0
+#define DEDUP_INPUT   0
+#define THREADS       1
+#define RESTORE_TIMER 60
+#define STATUS_TIMER  0
+#define METRICS_TIMER 10
+
+#define VERSION_BIN   20
+
+#define OUT_BUF_SIZE      0x100000
+#define OUT_BUF_SIZE_MIN  0x1000
+
+#define OUT_FORMAT_TEXT       0
+#define OUT_FORMAT_LENPREFIX  1
+#define OUT_FORMAT_FIXED16    2
+#define OUT_FORMAT_FIXED32    3
+
+#define OUT_BLOCK_HDR_SIZE    8
+
+#define RULES_BASE_CNT    0x100
 
-#define VERSION_BIN   19
+#define TIMINGS_MAX   16
 
-#define ALLOC_NEW_ELEMS  0x40000
-#define ALLOC_NEW_CHAINS 0x10
+#define JOB_SEGS_MAX  0x1000
+#define JOBS_PER_THR  2
 
-#define MIN(a,b) (((a) < (b)) ? (a) : (b))
-#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+/**
+ * Output: the candidates are written by a writer thread, so generation goes
+ * on while the writes block. writer_submit () queues a buffer and returns its
+ * ticket, the offset of its end in the output, the buffer must stay untouched
+ * until writer_wait () returned for that ticket. On Linux a pipe is fed with
+ * vmsplice (), the pipe then references the pages of the buffer instead of a
+ * copy, so a ticket is only done once the reader consumed it.
+ */
 
-typedef uint8_t  u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef uint64_t u64;
+#define WRITER_PIPE_SIZE  0x100000
+#define WRITER_POLL_MS    1
 
 typedef struct
 {
-  int len;
-  u64 cnt;
+  const char *buf;
+  u64         len;
 
-} pw_order_t;
+} writer_item_t;
 
 typedef struct
 {
-  u8    buf[IN_LEN_MAX];
+  FILE            *fp;
+  int              fd;
+  int              pipe;
+  int              splice;
+
+  writer_item_t   *items_buf;
+  int              items_cnt;
+  int              items_fill;
+  int              items_take;
+  int              items_queued;
+
+  u64              submit_bytes;
+  u64              written_bytes;
+
+  // seconds spent in writer_put (), written_bytes over it is the rate the reader takes
+
+  double           busy_time;
+
+  int              shutdown;
+
+  pthread_t        thread;
+  pthread_mutex_t  mux;
+  pthread_cond_t   cond_submit;
+  pthread_cond_t   cond_written;
 
-} elem_t;
+} writer_t;
 
 typedef struct
 {
-  u8    buf[IN_LEN_MAX];
-  int   cnt;
+  writer_t *writer;
+  u64       end;
 
-  mpz_t ks_cnt;
-  mpz_t ks_pos;
+} ticket_t;
 
-} chain_t;
+/**
+ * Output dedup: --dedup-output drops candidates that were written before, they
+ * come from chains of different elements that give the same string. Every
+ * length has a blocked Bloom filter, all probes of a candidate go to one block
+ * of 64 bytes, so a lookup is one cache miss. The filters are sized for the
+ * candidates of their length in the range at the given false positive rate, if
+ * all of them don't fit into --dedup-mem they get smaller and the rate higher.
+ * A false positive drops a candidate that was not written before, so a run
+ * whose rate would be more than DEDUP_FP_SLACK times the given one is
+ * refused. The filters run in the main thread on rendered buffers, in output
+ * order, a length's filter is freed once its chains are done.
+ */
+
+#define DEDUP_FP_RATE     0.001
+#define DEDUP_MEM         0x40000000
+#define DEDUP_MEM_MIN     0x1000
+#define DEDUP_BLOCK_WORDS 8
+#define DEDUP_PROBES_MAX  16
+#define DEDUP_BATCH       16
+#define DEDUP_FP_SLACK    2
+#define DEDUP_LOAD_MAX    500
 
 typedef struct
 {
-  elem_t  *elems_buf;
-  u64      elems_cnt;
-  u64      elems_alloc;
+  u64  *filters[OUT_LEN_MAX + 1];
+  u64   blocks_cnts[OUT_LEN_MAX + 1];
+
+  int   probes;
 
-  chain_t *chains_buf;
-  int      chains_cnt;
-  int      chains_pos;
-  int      chains_alloc;
+  double fp_rate;
 
-  u64      cur_chain_ks_poses[ELEM_CNT_MAX];
+  u64   dups_cnt;
 
-} db_entry_t;
+} dedup_t;
+
+/**
+ * Shards: with --output-shards every file has its own writer, a flushed
+ * buffer goes to the writer that gets it out first, judged by the bytes it
+ * has queued and the rate it wrote at so far, so a slow reader gets fewer
+ * chunks. The buffer is swapped for the spare buffer that is free first, a
+ * blocked shard only holds on to the spares it got. --manifest records the
+ * output positions each file got, consecutive chunks of one file are merged
+ * into one range.
+ */
 
 typedef struct
 {
   FILE *fp;
 
-  char  buf[BUFSIZ];
-  int   len;
+  char *buf;
+  u64   size;
+  u64   len;
+
+  int   format;
+
+  const rules_t *rules;
+
+  // the spares can still be with a writer, one per shard, units is the
+  // number of output positions in out->buf
+
+  writer_t  *writers_buf;
+  int        writers_cnt;
+
+  char     **spares_buf;
+  ticket_t  *spares_tickets;
+  int        spares_cnt;
+
+  u64        units;
+
+  char     **shard_files;
+  int        shard_last;
+
+  FILE      *manifest_fp;
+  int        manifest_shard;
+  mpz_t      manifest_beg;
+  mpz_t      manifest_pos;
+
+  dedup_t   *dedup;
 
 } out_t;
 
 /**
- * Default word-length distribution, calculated out of first 1,000,000 entries of rockyou.txt
+ * Multi-threaded generation: the segments of the main loop are packed into
+ * jobs. Workers render jobs in any order, the main thread writes them in ring
+ * order, so the output is identical to the single-threaded one.
  */
 
-#define DEF_WORDLEN_DIST_CNT 25
-
-static u64 DEF_WORDLEN_DIST[DEF_WORDLEN_DIST_CNT] =
-{
-  0,
-  15,
-  56,
-  350,
-  3315,
-  43721,
-  276252,
-  201748,
-  226412,
-  119885,
-  75075,
-  26323,
-  13373,
-  6353,
-  3540,
-  1877,
-  972,
-  311,
-  151,
-  81,
-  66,
-  21,
-  16,
-  13,
-  13
+enum
+{
+  JOB_FREE  = 0,
+  JOB_READY = 1,
+  JOB_BUSY  = 2,
+  JOB_DONE  = 3
 };
 
+typedef struct
+{
+  seg_t *segs_buf;
+  int    segs_cnt;
+
+  char  *buf;
+  u64    len;
+
+  u64    units;
+
+  // lengths whose chains ended in this job, bit pw_len - 1
+
+  u64    lens_done;
+
+  int    state;
+
+} job_t;
+
+typedef struct
+{
+  pthread_t        *threads_buf;
+  int               threads_cnt;
+
+  job_t            *jobs_buf;
+  int               jobs_cnt;
+  int               jobs_fill;
+  int               jobs_take;
+
+  const db_entry_t *db_entries;
+
+  int               format;
+
+  const rules_t    *rules;
+
+  u64               job_buf_size;
+
+  int               shutdown;
+
+  pthread_mutex_t   mux;
+  pthread_cond_t    cond_ready;
+  pthread_cond_t    cond_done;
+
+} pool_t;
+
+typedef struct
+{
+  u64    fingerprint;
+
+  int    pw_min;
+  int    pw_max;
+  int    elem_cnt_min;
+  int    elem_cnt_max;
+  int    wl_dist_len;
+  int    dedup_input;
+
+  mpz_t  skip;
+  mpz_t  limit;
+  mpz_t  pos;
+
+} restore_t;
+
+/**
+ * Database cache: --db-cache keeps the elements of a wordlist after dedup and
+ * sorting in a binary image, keyed by device, inode, size, mtime and ctime of
+ * the wordlist, a hash of its content and the options that change the
+ * elements. Reading the wordlist for the hash is cheap next to parsing and
+ * sorting it. A later run maps the image and uses the elements in place.
+ * Chains and keyspaces are GMP values and are rebuilt from the element
+ * counts, which is quick.
+ */
+
+#define DB_CACHE_MAGIC    0x4843414342445050ULL
+#define DB_CACHE_VERSION  2
+#define DB_CACHE_ALIGN    64
+#define DB_CACHE_READ     0x100000
+
+typedef struct
+{
+  u64 magic;
+  u64 version;
+
+  u64 wl_dev;
+  u64 wl_ino;
+  u64 wl_size;
+  u64 wl_mtime;
+  u64 wl_mtime_ns;
+  u64 wl_ctime;
+  u64 wl_hash;
+  u64 opts;
+
+  u64 fingerprint;
+  u64 dupes_cnt;
+  u64 elems_raw_cnts[IN_LEN_MAX + 1][CLASS_MASKS];
+
+  u64 elems_cnts[IN_LEN_MAX + 1];
+  u64 masks_offs[IN_LEN_MAX + 1][CLASS_MASKS + 1];
+  u64 elems_offs[IN_LEN_MAX + 1];
+  u64 weights_offs[IN_LEN_MAX + 1];
+
+  u64 file_size;
+
+} db_cache_t;
+
+/**
+ * Benchmark: the candidates are rendered as usual but not written, the
+ * counts per length and per element count are taken from the segments. The
+ * time from one segment to the next goes to the length and element count of
+ * the later one, so their speeds are comparable. With --threads that is the
+ * time the main thread took to hand the segment over, including the wait for
+ * a free job.
+ */
+
+typedef struct
+{
+  double          time_max;
+
+  struct timespec time_beg;
+  struct timespec time_last;
+
+  u64             cnt_mul;
+  u64             rec_lens[OUT_LEN_MAX + 1];
+
+  u64             pw_cnts[OUT_LEN_MAX + 1];
+  u64             pw_bytes[OUT_LEN_MAX + 1];
+  u64             elem_cnts[CHAIN_ELEMS_MAX + 1];
+  u64             elem_bytes[CHAIN_ELEMS_MAX + 1];
+
+  double          pw_times[OUT_LEN_MAX + 1];
+  double          elem_times[CHAIN_ELEMS_MAX + 1];
+
+} bench_t;
+
+/**
+ * Status: a line on stderr every --status-timer seconds or on SIGUSR1, and
+ * the same numbers in Prometheus text format in --metrics-file.
+ */
+
+typedef struct
+{
+  const char     *metrics_file;
+
+  int             print_timer;
+  int             timer;
+  time_t          next;
+
+  struct timespec time_beg;
+
+  u64             ks_mul;
+
+  mpz_t           ks_cnt;
+  mpz_t           ks_end;
+  mpz_t           ks_pos;
+
+  mpz_t           pos_beg;
+  mpz_t           tmp;
+
+} status_t;
+
+/**
+ * Timings: wall time and peak RSS when each phase of the startup and the
+ * generation is done, printed on stderr at the end with --timings.
+ */
+
+typedef struct
+{
+  int             json;
+
+  struct timespec time_last;
+
+  const char     *names[TIMINGS_MAX];
+  double          secs[TIMINGS_MAX];
+  u64             rss_kb[TIMINGS_MAX];
+  int             cnt;
+
+} timings_t;
+
 static const char *USAGE_MINI[] =
 {
   "Usage: %s [options] < wordlist",
@@ -145,6 +413,11 @@ static const char *USAGE_BIG[] =
   "* Misc:",
   "",
   "       --keyspace            Calculate number of combinations",
+  "       --status-timer=NUM    Print status every NUM seconds, SIGUSR1 prints it at once",
+  "       --benchmark=NUM       Generate for NUM seconds without output and print the speed",
+  "       --timings[=json]      Print time and peak memory of each phase on stderr at the end",
+  "       --nth=NUM             Print the candidate at position NUM",
+  "       --rank=WORD           Print every position generating WORD with its chain and elements",
   "",
   "* Optimization:",
   "",
@@ -153,15 +426,33 @@ static const char *USAGE_BIG[] =
   "       --elem-cnt-min=NUM    Minimum number of elements per chain",
   "       --elem-cnt-max=NUM    Maximum number of elements per chain",
   "       --wl-dist-len         Calculate output length distribution from wordlist",
+  "       --dedup-input         Remove duplicate words from wordlist",
+  "       --dedup-output[=RATE] Drop candidates printed before, RATE is the false positive rate",
+  "       --dedup-mem=NUM       Memory for --dedup-output in bytes",
+  "       --weighted            Wordlist is word<TAB>count, generate likely candidates first",
+  "       --require=LIST        Only candidates with all of lower,upper,digit,special in LIST",
   "",
   "* Resources:",
   "",
+  "       --threads=NUM         Number of generator threads",
+  "       --out-buf-size=NUM    Size of output buffer in bytes",
   "  -s,  --skip=NUM            Skip NUM passwords from start (for distributed)",
   "  -l,  --limit=NUM           Limit output to NUM passwords (for distributed)",
+  "       --split=K/N           Set skip and limit to the share of node K of N",
+  "       --split-bytes         Balance --split by output bytes instead of candidates",
   "",
   "* Files:",
   "",
   "  -o,  --output-file=FILE    Output-file",
+  "       --output-format=FMT   Output format: text, lenprefix, fixed16 or fixed32",
+  "  -w,  --wordlist=FILE       Read wordlist from FILE instead of stdin",
+  "       --rules=FILE          Apply the hashcat rules in FILE to each candidate",
+  "       --restore-file=FILE   Save position to FILE and resume from it",
+  "       --restore-timer=NUM   Save position every NUM seconds",
+  "       --metrics-file=FILE   Write status in Prometheus text format to FILE",
+  "       --db-cache=FILE       Keep the preprocessed wordlist in FILE for a faster start",
+  "       --output-shards=LIST  Deal the output out in chunks to the comma separated files or FIFOs",
+  "       --manifest=FILE       Record the output ranges each shard got in FILE",
   "",
   NULL
 };
@@ -212,54 +503,6 @@ static void usage_big_print (const char *progname)
   }
 }
 
-static void check_realloc_elems (db_entry_t *db_entry)
-{
-  if (db_entry->elems_cnt == db_entry->elems_alloc)
-  {
-    const u64 elems_alloc = db_entry->elems_alloc;
-
-    const u64 elems_alloc_new = elems_alloc + ALLOC_NEW_ELEMS;
-
-    db_entry->elems_buf = (elem_t *) realloc (db_entry->elems_buf, elems_alloc_new * sizeof (elem_t));
-
-    if (db_entry->elems_buf == NULL)
-    {
-      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
-               (size_t)elems_alloc_new * sizeof (elem_t));
-
-      exit (-1);
-    }
-
-    memset (&db_entry->elems_buf[elems_alloc], 0, ALLOC_NEW_ELEMS * sizeof (elem_t));
-
-    db_entry->elems_alloc = elems_alloc_new;
-  }
-}
-
-static void check_realloc_chains (db_entry_t *db_entry)
-{
-  if (db_entry->chains_cnt == db_entry->chains_alloc)
-  {
-    const u64 chains_alloc = db_entry->chains_alloc;
-
-    const u64 chains_alloc_new = chains_alloc + ALLOC_NEW_CHAINS;
-
-    db_entry->chains_buf = (chain_t *) realloc (db_entry->chains_buf, chains_alloc_new * sizeof (chain_t));
-
-    if (db_entry->chains_buf == NULL)
-    {
-      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
-               (size_t)chains_alloc_new * sizeof (chain_t));
-
-      exit (-1);
-    }
-
-    memset (&db_entry->chains_buf[chains_alloc], 0, ALLOC_NEW_CHAINS * sizeof (chain_t));
-
-    db_entry->chains_alloc = chains_alloc_new;
-  }
-}
-
 static int in_superchop (char *buf)
 {
   int len = strlen (buf);
@@ -288,231 +531,2240 @@ static int in_superchop (char *buf)
   return len;
 }
 
-static void out_flush (out_t *out)
+/**
+ * Output formats: text is the candidate and a newline, lenprefix is a length
+ * byte and the candidate. fixed16 and fixed32 pad the candidates with zeros to
+ * 16 or 32 bytes and write them in blocks of one length, each block starts
+ * with a header of two native-endian u32, the length and the number of
+ * candidates in the block.
+ */
+
+static int rec_pre_get (const int format)
+{
+  return (format == OUT_FORMAT_LENPREFIX) ? 1 : 0;
+}
+
+static int rec_len_get (const int format, const int pw_len)
 {
-  fwrite (out->buf, 1, out->len, out->fp);
+  if (format == OUT_FORMAT_FIXED16) return 16;
+  if (format == OUT_FORMAT_FIXED32) return 32;
 
-  out->len = 0;
+  return pw_len + 1;
 }
 
-static void out_push (out_t *out, const char *pw_buf, const int pw_len)
+static int rec_hdr_size (const int format)
 {
-  memcpy (out->buf + out->len, pw_buf, pw_len);
+  return ((format == OUT_FORMAT_FIXED16) || (format == OUT_FORMAT_FIXED32)) ? OUT_BLOCK_HDR_SIZE : 0;
+}
+
+static void rec_tpl_init (const int format, const seg_t *seg, const db_entry_t *db_entries, char pw_buf[OUT_SLACK])
+{
+  // the template is one record and the prefix of the next one, padding stays zero
+
+  const int pw_len = seg->pw_len;
 
-  out->len += pw_len;
+  memset (pw_buf, 0, OUT_SLACK);
 
-  if (out->len >= BUFSIZ - 100)
+  if (format == OUT_FORMAT_TEXT)
   {
-    out_flush (out);
+    pw_buf[pw_len] = '\n';
+  }
+  else if (format == OUT_FORMAT_LENPREFIX)
+  {
+    pw_buf[0]          = (char) pw_len;
+    pw_buf[pw_len + 1] = (char) pw_len;
   }
+
+  chain_set_pwbuf_init (&seg->chain_buf, db_entries, seg->cur_chain_ks_poses, pw_buf + rec_pre_get (format));
 }
 
-static int sort_by_cnt (const void *p1, const void *p2)
+static u64 rec_block_emit (const int format, const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf, const int pw_len, const u64 iter_cnt, char *out_buf)
 {
-  const pw_order_t *o1 = (const pw_order_t *) p1;
-  const pw_order_t *o2 = (const pw_order_t *) p2;
+  const int hdr_size = rec_hdr_size (format);
 
-  // Descending order
-  if (o1->cnt > o2->cnt) return -1;
-  if (o1->cnt < o2->cnt) return  1;
+  if (hdr_size)
+  {
+    const u32 hdr[2] = { (u32) pw_len, (u32) iter_cnt };
 
-  return 0;
+    memcpy (out_buf, hdr, OUT_BLOCK_HDR_SIZE);
+  }
+
+  return hdr_size + chain_emit (chain_buf, db_entries, cur_chain_ks_poses, pw_buf, rec_pre_get (format), rec_len_get (format, pw_len), iter_cnt, out_buf + hdr_size);
 }
 
-static int sort_by_ks (const void *p1, const void *p2)
+/**
+ * Rules: the candidates are rendered as text in batches, then each of them
+ * goes through all rules. The output of a candidate is planned with the upper
+ * bound rec_max of its length and is never split over two buffers.
+ */
+
+static u64 rules_block_emit (const rules_t *rules, const int format, const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf, const int pw_len, u64 iter_cnt, char *out_buf)
 {
-  const chain_t *f1 = (const chain_t *) p1;
-  const chain_t *f2 = (const chain_t *) p2;
+  char base_buf[RULES_BASE_CNT * (OUT_LEN_MAX + 1) + OUT_SLACK];
 
-  return mpz_cmp (f1->ks_cnt, f2->ks_cnt);
-}
+  const int len_prefix = (format == OUT_FORMAT_LENPREFIX);
 
-static int chain_valid_with_db (const chain_t *chain_buf, const db_entry_t *db_entries)
-{
-  const u8 *buf = chain_buf->buf;
-  const int cnt = chain_buf->cnt;
+  char *dst = out_buf;
 
-  for (int idx = 0; idx < cnt; idx++)
+  while (iter_cnt)
   {
-    const u8 db_key = buf[idx];
+    const u64 base_cnt = MIN (iter_cnt, RULES_BASE_CNT);
+
+    chain_emit (chain_buf, db_entries, cur_chain_ks_poses, pw_buf, 0, pw_len + 1, base_cnt, base_buf);
 
-    const db_entry_t *db_entry = &db_entries[db_key];
+    for (u64 base_idx = 0; base_idx < base_cnt; base_idx++)
+    {
+      dst += rules_emit (rules, len_prefix, base_buf + base_idx * (pw_len + 1), pw_len, 0, rules->rules_cnt, dst);
+    }
 
-    if (db_entry->elems_cnt == 0) return 0;
+    iter_cnt -= base_cnt;
   }
 
-  return 1;
+  return dst - out_buf;
 }
 
-static int chain_valid_with_cnt_min (const chain_t *chain_buf, const int elem_cnt_min)
+static double time_elapsed (const struct timespec *time_beg)
 {
-  const int cnt = chain_buf->cnt;
+  struct timespec now;
 
-  if (cnt < elem_cnt_min) return 0;
+  clock_gettime (CLOCK_MONOTONIC, &now);
 
-  return 1;
+  return (double) (now.tv_sec - time_beg->tv_sec) + (double) (now.tv_nsec - time_beg->tv_nsec) / 1e9;
 }
 
-static int chain_valid_with_cnt_max (const chain_t *chain_buf, const int elem_cnt_max)
+static void writer_put (writer_t *writer, const char *buf, const u64 len)
 {
-  const int cnt = chain_buf->cnt;
+  #ifdef LINUX
 
-  if (cnt > elem_cnt_max) return 0;
+  struct iovec iov;
 
-  return 1;
-}
+  iov.iov_base = (void *) buf;
+  iov.iov_len  = len;
 
-static void chain_ks (const chain_t *chain_buf, const db_entry_t *db_entries, mpz_t ks_cnt)
-{
-  const u8 *buf = chain_buf->buf;
-  const int cnt = chain_buf->cnt;
+  while (writer->splice && iov.iov_len)
+  {
+    const ssize_t n = vmsplice (writer->fd, &iov, 1, 0);
 
-  mpz_set_si (ks_cnt, 1);
+    if (n > 0)
+    {
+      iov.iov_base  = (char *) iov.iov_base + n;
+      iov.iov_len  -= n;
 
-  for (int idx = 0; idx < cnt; idx++)
-  {
-    const u8 db_key = buf[idx];
+      continue;
+    }
 
-    const db_entry_t *db_entry = &db_entries[db_key];
+    if (errno == EINTR) continue;
 
-    const u64 elems_cnt = db_entry->elems_cnt;
+    if (errno == EAGAIN)
+    {
+      struct pollfd pfd = { writer->fd, POLLOUT, 0 };
+
+      poll (&pfd, 1, WRITER_POLL_MS);
+
+      continue;
+    }
 
-    mpz_mul_ui (ks_cnt, ks_cnt, elems_cnt);
+    // not supported for this pipe, the rest goes the usual way
+
+    if ((errno == EINVAL) || (errno == ENOSYS)) writer->splice = 0;
+
+    break;
   }
+
+  if (writer->splice) return;
+
+  fwrite (iov.iov_base, 1, iov.iov_len, writer->fp);
+
+  #else
+
+  fwrite (buf, 1, len, writer->fp);
+
+  #endif
 }
 
-static void set_chain_ks_poses (const chain_t *chain_buf, const db_entry_t *db_entries, mpz_t tmp, u64 cur_chain_ks_poses[ELEM_CNT_MAX])
+static void *writer_worker (void *p)
 {
-  const u8 *buf = chain_buf->buf;
+  writer_t *writer = (writer_t *) p;
 
-  const int cnt = chain_buf->cnt;
+  pthread_mutex_lock (&writer->mux);
 
-  for (int idx = 0; idx < cnt; idx++)
+  while (1)
   {
-    const u8 db_key = buf[idx];
+    if (writer->items_queued == 0)
+    {
+      if (writer->shutdown) break;
 
-    const db_entry_t *db_entry = &db_entries[db_key];
+      pthread_cond_wait (&writer->cond_submit, &writer->mux);
 
-    const u64 elems_cnt = db_entry->elems_cnt;
+      continue;
+    }
+
+    const writer_item_t item = writer->items_buf[writer->items_take];
+
+    pthread_mutex_unlock (&writer->mux);
+
+    struct timespec time_beg;
 
-    cur_chain_ks_poses[idx] = mpz_fdiv_ui (tmp, elems_cnt);
+    clock_gettime (CLOCK_MONOTONIC, &time_beg);
 
-    mpz_div_ui (tmp, tmp, elems_cnt);
+    writer_put (writer, item.buf, item.len);
+
+    const double busy_time = time_elapsed (&time_beg);
+
+    pthread_mutex_lock (&writer->mux);
+
+    writer->items_take = (writer->items_take + 1) % writer->items_cnt;
+
+    writer->items_queued--;
+
+    writer->written_bytes += item.len;
+
+    writer->busy_time += busy_time;
+
+    pthread_cond_broadcast (&writer->cond_written);
   }
+
+  pthread_mutex_unlock (&writer->mux);
+
+  return NULL;
 }
 
-static void chain_set_pwbuf_init (const chain_t *chain_buf, const db_entry_t *db_entries, const u64 cur_chain_ks_poses[ELEM_CNT_MAX], char *pw_buf)
+static void writer_init (writer_t *writer, FILE *fp, const int items_cnt, const u64 buf_size)
 {
-  const u8 *buf = chain_buf->buf;
+  memset (writer, 0, sizeof (writer_t));
 
-  const u32 cnt = chain_buf->cnt;
+  writer->fp        = fp;
+  writer->fd        = fileno (fp);
+  writer->items_cnt = items_cnt;
+  writer->items_buf = (writer_item_t *) calloc (items_cnt, sizeof (writer_item_t));
 
-  for (u32 idx = 0; idx < cnt; idx++)
+  if (writer->items_buf == NULL)
   {
-    const u8 db_key = buf[idx];
+    fprintf (stderr, "Out of memory trying to allocate writer queue!\n");
+
+    exit (-1);
+  }
+
+  // the writer bypasses the stdio buffer on pipes
 
-    const db_entry_t *db_entry = &db_entries[db_key];
+  fflush (fp);
 
-    const u64 elems_idx = cur_chain_ks_poses[idx];
+  #ifdef LINUX
 
-    memcpy (pw_buf, &db_entry->elems_buf[elems_idx], db_key);
+  struct stat st;
 
-    pw_buf += db_key;
+  if ((fstat (writer->fd, &st) == 0) && S_ISFIFO (st.st_mode))
+  {
+    writer->pipe   = 1;
+    writer->splice = 1;
+
+    // a larger pipe lets the reader fall behind by a whole buffer, it is fine if it can not grow
+
+    fcntl (writer->fd, F_SETPIPE_SZ, (int) MIN (buf_size, WRITER_PIPE_SIZE));
   }
+
+  #else
+
+  (void) buf_size;
+
+  #endif
+
+  pthread_mutex_init (&writer->mux, NULL);
+
+  pthread_cond_init (&writer->cond_submit,  NULL);
+  pthread_cond_init (&writer->cond_written, NULL);
+
+  pthread_create (&writer->thread, NULL, writer_worker, writer);
 }
 
-static void chain_set_pwbuf_increment (const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[ELEM_CNT_MAX], char *pw_buf)
+static u64 writer_submit (writer_t *writer, const char *buf, const u64 len)
 {
-  const u8 *buf = chain_buf->buf;
+  pthread_mutex_lock (&writer->mux);
 
-  const int cnt = chain_buf->cnt;
-
-  for (int idx = 0; idx < cnt; idx++)
+  while (writer->items_queued == writer->items_cnt)
   {
-    const u8 db_key = buf[idx];
+    pthread_cond_wait (&writer->cond_written, &writer->mux);
+  }
 
-    const db_entry_t *db_entry = &db_entries[db_key];
+  writer_item_t *item = &writer->items_buf[writer->items_fill];
 
-    const u64 elems_cnt = db_entry->elems_cnt;
+  item->buf = buf;
+  item->len = len;
 
-    const u64 elems_idx = ++cur_chain_ks_poses[idx];
+  writer->items_fill = (writer->items_fill + 1) % writer->items_cnt;
 
-    if (elems_idx < elems_cnt)
-    {
-      memcpy (pw_buf, &db_entry->elems_buf[elems_idx], db_key);
+  writer->items_queued++;
 
-      break;
-    }
+  writer->submit_bytes += len;
+
+  const u64 ticket = writer->submit_bytes;
+
+  pthread_cond_signal (&writer->cond_submit);
+
+  pthread_mutex_unlock (&writer->mux);
+
+  return ticket;
+}
 
-    cur_chain_ks_poses[idx] = 0;
+static void writer_sync (writer_t *writer, const u64 ticket)
+{
+  // written, but maybe not yet read from a pipe
 
-    memcpy (pw_buf, &db_entry->elems_buf[0], db_key);
+  pthread_mutex_lock (&writer->mux);
 
-    pw_buf += db_key;
+  while (writer->written_bytes < ticket)
+  {
+    pthread_cond_wait (&writer->cond_written, &writer->mux);
   }
+
+  pthread_mutex_unlock (&writer->mux);
 }
 
-static void chain_gen_with_idx (chain_t *chain_buf, const int len1, const int chains_idx)
+static void writer_wait (writer_t *writer, const u64 ticket)
 {
-  chain_buf->cnt = 0;
+  if (writer == NULL) return;
 
-  u8 db_key = 1;
+  writer_sync (writer, ticket);
 
-  for (int chains_shr = 0; chains_shr < len1; chains_shr++)
+  #ifdef LINUX
+
+  // whatever the pipe still holds is the end of what went in so far, taking written_bytes
+  // first can only make that look larger
+
+  while (writer->splice)
   {
-    if ((chains_idx >> chains_shr) & 1)
-    {
-      chain_buf->buf[chain_buf->cnt] = db_key;
+    pthread_mutex_lock (&writer->mux);
 
-      chain_buf->cnt++;
+    const u64 written_bytes = writer->written_bytes;
 
-      db_key = 1;
-    }
-    else
+    pthread_mutex_unlock (&writer->mux);
+
+    int unread = 0;
+
+    if (ioctl (writer->fd, FIONREAD, &unread) == -1) break;
+
+    if ((written_bytes - unread) >= ticket) break;
+
+    // no reader left, nobody is going to look at the pages again
+
+    struct pollfd pfd = { writer->fd, POLLOUT, 0 };
+
+    if (poll (&pfd, 1, WRITER_POLL_MS) > 0)
     {
-      db_key++;
+      if (pfd.revents & POLLERR) break;
     }
   }
 
-  chain_buf->buf[chain_buf->cnt] = db_key;
-
-  chain_buf->cnt++;
+  #endif
 }
 
-int main (int argc, char *argv[])
+static void writer_finish (writer_t *writer)
 {
-  mpz_t pw_ks_pos[PW_MAX + 1];
-  mpz_t pw_ks_cnt[PW_MAX + 1];
+  writer_wait (writer, writer->submit_bytes);
 
-  mpz_t iter_max;         mpz_init_set_si (iter_max,        0);
-  mpz_t total_ks_cnt;     mpz_init_set_si (total_ks_cnt,    0);
-  mpz_t total_ks_pos;     mpz_init_set_si (total_ks_pos,    0);
-  mpz_t total_ks_left;    mpz_init_set_si (total_ks_left,   0);
-  mpz_t skip;             mpz_init_set_si (skip,            0);
-  mpz_t limit;            mpz_init_set_si (limit,           0);
-  mpz_t tmp;              mpz_init_set_si (tmp,             0);
+  pthread_mutex_lock (&writer->mux);
 
-  int     version       = 0;
-  int     usage         = 0;
-  int     keyspace      = 0;
-  int     pw_min        = PW_MIN;
-  int     pw_max        = PW_MAX;
-  int     elem_cnt_min  = ELEM_CNT_MIN;
-  int     elem_cnt_max  = ELEM_CNT_MAX;
-  int     wl_dist_len   = WL_DIST_LEN;
-  char   *output_file   = NULL;
+  writer->shutdown = 1;
 
-  #define IDX_VERSION       'V'
-  #define IDX_USAGE         'h'
+  pthread_cond_signal (&writer->cond_submit);
+
+  pthread_mutex_unlock (&writer->mux);
+
+  pthread_join (writer->thread, NULL);
+
+  fflush (writer->fp);
+
+  pthread_mutex_destroy (&writer->mux);
+
+  pthread_cond_destroy (&writer->cond_submit);
+  pthread_cond_destroy (&writer->cond_written);
+
+  free (writer->items_buf);
+}
+
+static int writer_done (writer_t *writer, const u64 ticket)
+{
+  // writer_wait () without the waiting
+
+  pthread_mutex_lock (&writer->mux);
+
+  const u64 written_bytes = writer->written_bytes;
+
+  pthread_mutex_unlock (&writer->mux);
+
+  if (written_bytes < ticket) return 0;
+
+  #ifdef LINUX
+
+  int unread = 0;
+
+  if (writer->splice && (ioctl (writer->fd, FIONREAD, &unread) == 0) && ((written_bytes - unread) < ticket)) return 0;
+
+  #endif
+
+  return 1;
+}
+
+static double writer_eta (writer_t *writer, const u64 end)
+{
+  // seconds until the reader has the output up to end, at the rate the writer wrote at so far.
+  // What the reader did not take from the pipe yet is not out, a writer that did not write
+  // anything yet is taken to be fast
+
+  pthread_mutex_lock (&writer->mux);
+
+  const u64    written_bytes = writer->written_bytes;
+  const double busy_time     = writer->busy_time;
+
+  pthread_mutex_unlock (&writer->mux);
+
+  u64 out_bytes = written_bytes;
+
+  #ifdef LINUX
+
+  int unread = 0;
+
+  if (writer->pipe && (ioctl (writer->fd, FIONREAD, &unread) == 0)) out_bytes -= MIN (out_bytes, (u64) unread);
+
+  #endif
+
+  if ((end <= out_bytes) || (written_bytes == 0)) return 0;
+
+  return (double) (end - out_bytes) * busy_time / (double) written_bytes;
+}
+
+static void ticket_wait (const ticket_t *ticket)
+{
+  writer_wait (ticket->writer, ticket->end);
+}
+
+static int ticket_done (const ticket_t *ticket)
+{
+  if (ticket->writer == NULL) return 1;
+
+  return writer_done (ticket->writer, ticket->end);
+}
+
+static void out_manifest_line (out_t *out)
+{
+  if (out->manifest_shard == -1) return;
+
+  if (mpz_cmp (out->manifest_beg, out->manifest_pos) == 0) return;
+
+  gmp_fprintf (out->manifest_fp, "%Zd %Zd %s\n", out->manifest_beg, out->manifest_pos, out->shard_files[out->manifest_shard]);
+
+  mpz_set (out->manifest_beg, out->manifest_pos);
+}
+
+static void out_manifest_add (out_t *out, const int shard, const u64 units)
+{
+  if (out->manifest_fp == NULL) return;
+
+  if (shard != out->manifest_shard)
+  {
+    out_manifest_line (out);
+
+    out->manifest_shard = shard;
+
+    mpz_set (out->manifest_beg, out->manifest_pos);
+  }
+
+  mpz_add_ui (out->manifest_pos, out->manifest_pos, units);
+}
+
+static ticket_t out_write (out_t *out, const char *buf, const u64 len, const u64 units)
+{
+  ticket_t ticket = { NULL, 0 };
+
+  // no writer in --benchmark mode, the candidates are dropped
+
+  if (out->writers_cnt == 0) return ticket;
+
+  // the shard that has the buffer out first wins, so on equal backlogs the faster one. On a tie
+  // the shard after the last one, that is how every shard gets measured at the start
+
+  int shard = 0;
+
+  if (out->writers_cnt > 1)
+  {
+    double eta_min = HUGE_VAL;
+
+    for (int writers_pos = 1; writers_pos <= out->writers_cnt; writers_pos++)
+    {
+      const int writers_idx = (out->shard_last + writers_pos) % out->writers_cnt;
+
+      writer_t *writer = &out->writers_buf[writers_idx];
+
+      pthread_mutex_lock (&writer->mux);
+
+      const u64 submit_bytes = writer->submit_bytes;
+
+      pthread_mutex_unlock (&writer->mux);
+
+      const double eta = writer_eta (writer, submit_bytes + len);
+
+      if (eta >= eta_min) continue;
+
+      eta_min = eta;
+
+      shard = writers_idx;
+    }
+  }
+
+  out->shard_last = shard;
+
+  out_manifest_add (out, shard, units);
+
+  ticket.writer = &out->writers_buf[shard];
+  ticket.end    = writer_submit (ticket.writer, buf, len);
+
+  return ticket;
+}
+
+static char *out_swap (out_t *out, char *buf, const u64 len, const u64 units)
+{
+  // buf goes to a writer and takes the place of a spare, the first one that is free or else the
+  // one whose writer should be done with it first
+
+  const ticket_t ticket = out_write (out, buf, len, units);
+
+  int spare = 0;
+
+  double eta_min = HUGE_VAL;
+
+  for (int spares_idx = 0; spares_idx < out->spares_cnt; spares_idx++)
+  {
+    const ticket_t *spare_ticket = &out->spares_tickets[spares_idx];
+
+    if (ticket_done (spare_ticket))
+    {
+      spare = spares_idx;
+
+      break;
+    }
+
+    const double eta = writer_eta (spare_ticket->writer, spare_ticket->end);
+
+    if (eta >= eta_min) continue;
+
+    eta_min = eta;
+
+    spare = spares_idx;
+  }
+
+  ticket_wait (&out->spares_tickets[spare]);
+
+  char *spare_buf = out->spares_buf[spare];
+
+  out->spares_buf[spare]     = buf;
+  out->spares_tickets[spare] = ticket;
+
+  return spare_buf;
+}
+
+static void out_flush (out_t *out)
+{
+  // continue in a spare as soon as its writer is done with it
+
+  if (out->len == 0) return;
+
+  out->buf   = out_swap (out, out->buf, out->len, out->units);
+  out->len   = 0;
+  out->units = 0;
+}
+
+static void out_sync (out_t *out)
+{
+  // everything so far is handed to the files or pipes
+
+  out_flush (out);
+
+  for (int writers_idx = 0; writers_idx < out->writers_cnt; writers_idx++)
+  {
+    writer_t *writer = &out->writers_buf[writers_idx];
+
+    writer_sync (writer, writer->submit_bytes);
+
+    fflush (writer->fp);
+  }
+
+  if (out->manifest_fp)
+  {
+    out_manifest_line (out);
+
+    fflush (out->manifest_fp);
+  }
+}
+
+static double dedup_rate (const int probes, const double load)
+{
+  // the false positive rate at load candidates per block. The candidates per block follow a
+  // Poisson distribution and each block is a small plain Bloom filter
+
+  const double block_bits = DEDUP_BLOCK_WORDS * 64;
+
+  if (load <= 0) return 0;
+
+  if (load > DEDUP_LOAD_MAX) return pow (1 - exp (-probes * load / block_bits), probes);
+
+  double p = exp (-load);
+
+  double rate = 0;
+
+  const int cnt_max = (int) (4 * load) + 64;
+
+  for (int cnt = 0; cnt <= cnt_max; cnt++)
+  {
+    if (cnt) p *= load / cnt;
+
+    rate += p * pow (1 - pow (1 - 1 / block_bits, (double) probes * cnt), probes);
+  }
+
+  return rate;
+}
+
+static void dedup_init (dedup_t *dedup, const int pw_min, const int pw_max, const double *cands, const double fp_rate, const u64 mem_max)
+{
+  // -log2 of the rate rounded up is the number of probes, the load per block is lowered until
+  // the rate is met. cands are the candidates of each length in the range
+
+  int probes = 0;
+
+  for (double rate = fp_rate; rate < 1; rate *= 2) probes++;
+
+  dedup->probes   = MIN (probes, DEDUP_PROBES_MAX);
+  dedup->dups_cnt = 0;
+
+  const double block_bytes = DEDUP_BLOCK_WORDS * sizeof (u64);
+
+  double load = block_bytes * 8 / (dedup->probes * 1.44);
+
+  while ((load > 1) && (dedup_rate (dedup->probes, load) > fp_rate)) load *= 0.9;
+
+  double bytes_need[OUT_LEN_MAX + 1];
+
+  double bytes_total = 0;
+
+  for (int pw_len = 0; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    dedup->filters[pw_len]     = NULL;
+    dedup->blocks_cnts[pw_len] = 0;
+
+    bytes_need[pw_len] = 0;
+
+    if ((pw_len < pw_min) || (pw_len > pw_max)) continue;
+
+    bytes_need[pw_len] = MIN (cands[pw_len] / load * block_bytes, (double) mem_max);
+
+    bytes_total += bytes_need[pw_len];
+  }
+
+  const double scale = (bytes_total > mem_max) ? mem_max / bytes_total : 1;
+
+  dedup->fp_rate = 0;
+
+  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  {
+    const u64 blocks_cnt = MAX ((u64) ceil (bytes_need[pw_len] * scale / block_bytes), 1);
+
+    dedup->blocks_cnts[pw_len] = blocks_cnt;
+
+    dedup->fp_rate = MAX (dedup->fp_rate, dedup_rate (dedup->probes, cands[pw_len] / blocks_cnt));
+  }
+}
+
+static void dedup_release (dedup_t *dedup, const int pw_len)
+{
+  free (dedup->filters[pw_len]);
+
+  dedup->filters[pw_len] = NULL;
+}
+
+static void dedup_free (dedup_t *dedup)
+{
+  for (int pw_len = 0; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    dedup_release (dedup, pw_len);
+  }
+}
+
+static u64 dedup_hash (const char *pw, const int pw_len)
+{
+  // 8 bytes at a time, the length is the same for all candidates of a filter
+
+  u64 hash = 0x9e3779b97f4a7c15;
+
+  for (int pos = 0; pos < pw_len; pos += 8)
+  {
+    u64 word = 0;
+
+    memcpy (&word, pw + pos, MIN (pw_len - pos, 8));
+
+    hash = (hash ^ word) * 0xbf58476d1ce4e5b9;
+
+    hash ^= hash >> 31;
+  }
+
+  hash *= 0x94d049bb133111eb;
+
+  hash ^= hash >> 29;
+
+  return hash;
+}
+
+static u64 *dedup_filter (dedup_t *dedup, const int pw_len)
+{
+  u64 *filter = dedup->filters[pw_len];
+
+  if (filter) return filter;
+
+  const u64 blocks_cnt = dedup->blocks_cnts[pw_len];
+
+  filter = (u64 *) calloc (blocks_cnt, DEDUP_BLOCK_WORDS * sizeof (u64));
+
+  if (filter == NULL)
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+             (size_t) (blocks_cnt * DEDUP_BLOCK_WORDS * sizeof (u64)));
+
+    exit (-1);
+  }
+
+  dedup->filters[pw_len] = filter;
+
+  return filter;
+}
+
+static int dedup_seen (const dedup_t *dedup, u64 *block, const u64 hash)
+{
+  // the probes are 9 bit slices of a second hash, it is mixed again after 7 of them. The bits
+  // are collected per word first, that keeps the branches out of the loop
+
+  u64 masks[DEDUP_BLOCK_WORDS] = { 0 };
+
+  u64 mix  = hash;
+  u64 bits = 0;
+
+  for (int probe = 0; probe < dedup->probes; probe++)
+  {
+    if ((probe % 7) == 0)
+    {
+      mix = (mix ^ (mix >> 32)) * 0xd6e8feb86659fd93;
+
+      bits = mix;
+    }
+
+    masks[(bits >> 6) & 7] |= 1ULL << (bits & 63);
+
+    bits >>= 9;
+  }
+
+  u64 missing = 0;
+
+  for (int word = 0; word < DEDUP_BLOCK_WORDS; word++)
+  {
+    missing |= masks[word] & ~block[word];
+
+    block[word] |= masks[word];
+  }
+
+  return (missing == 0);
+}
+
+static u64 dedup_block (dedup_t *dedup, const int format, const int pw_len, char *buf, const u64 len)
+{
+  // buf is a block of one length from rec_block_emit (), the candidates seen before are taken
+  // out in place and the header is fixed, returns the new size. The filter blocks of a batch
+  // are fetched before the first of them is probed
+
+  const int hdr_size = rec_hdr_size (format);
+  const int rec_pre  = rec_pre_get  (format);
+  const u64 rec_len  = rec_len_get  (format, pw_len);
+
+  const u64 iter_cnt = (len - hdr_size) / rec_len;
+
+  u64 *filter = dedup_filter (dedup, pw_len);
+
+  const u64 blocks_cnt = dedup->blocks_cnts[pw_len];
+
+  u64  hashes[DEDUP_BATCH];
+  u64 *blocks[DEDUP_BATCH];
+
+  char *dst = buf + hdr_size;
+
+  for (u64 iter_beg = 0; iter_beg < iter_cnt; iter_beg += DEDUP_BATCH)
+  {
+    const int batch_cnt = (int) MIN (iter_cnt - iter_beg, DEDUP_BATCH);
+
+    for (int batch_idx = 0; batch_idx < batch_cnt; batch_idx++)
+    {
+      const char *rec = buf + hdr_size + ((iter_beg + batch_idx) * rec_len);
+
+      hashes[batch_idx] = dedup_hash (rec + rec_pre, pw_len);
+      blocks[batch_idx] = filter + (hashes[batch_idx] % blocks_cnt) * DEDUP_BLOCK_WORDS;
+
+      __builtin_prefetch (blocks[batch_idx], 1);
+    }
+
+    for (int batch_idx = 0; batch_idx < batch_cnt; batch_idx++)
+    {
+      const char *rec = buf + hdr_size + ((iter_beg + batch_idx) * rec_len);
+
+      if (dedup_seen (dedup, blocks[batch_idx], hashes[batch_idx]))
+      {
+        dedup->dups_cnt++;
+
+        continue;
+      }
+
+      if (dst != rec) memcpy (dst, rec, rec_len);
+
+      dst += rec_len;
+    }
+  }
+
+  const u64 outs_cnt = (dst - buf - hdr_size) / rec_len;
+
+  // an empty block is left out, header included
+
+  if (outs_cnt == 0) return 0;
+
+  if (hdr_size)
+  {
+    const u32 hdr[2] = { (u32) pw_len, (u32) outs_cnt };
+
+    memcpy (buf, hdr, OUT_BLOCK_HDR_SIZE);
+  }
+
+  return dst - buf;
+}
+
+static void dedup_job (dedup_t *dedup, job_t *job, const int format)
+{
+  // the job buffer is the blocks of its segments one after the other
+
+  const int hdr_size = rec_hdr_size (format);
+
+  char *src = job->buf;
+  char *dst = job->buf;
+
+  for (int segs_idx = 0; segs_idx < job->segs_cnt; segs_idx++)
+  {
+    const seg_t *seg = &job->segs_buf[segs_idx];
+
+    const u64 len = hdr_size + (seg->iter_cnt * rec_len_get (format, seg->pw_len));
+
+    const u64 kept = dedup_block (dedup, format, seg->pw_len, src, len);
+
+    memmove (dst, src, kept);
+
+    src += len;
+    dst += kept;
+  }
+
+  job->len = dst - job->buf;
+
+  for (int pw_len = IN_LEN_MIN; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    if (job->lens_done & (1ULL << (pw_len - 1))) dedup_release (dedup, pw_len);
+  }
+}
+
+static int wl_load (const char *wordlist_file, db_entry_t *db_entries, const int threads, const int weighted)
+{
+  int fd = open (wordlist_file, O_RDONLY);
+
+  if (fd == -1)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    return -1;
+  }
+
+  struct stat st;
+
+  if (fstat (fd, &st) == -1)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    close (fd);
+
+    return -1;
+  }
+
+  const u64 wl_len = st.st_size;
+
+  if (wl_len == 0)
+  {
+    close (fd);
+
+    return 0;
+  }
+
+  #ifdef WINDOWS
+
+  char *wl_buf = (char *) malloc (wl_len);
+
+  if (wl_buf == NULL)
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) wl_len);
+
+    close (fd);
+
+    return -1;
+  }
+
+  FILE *fp = fdopen (fd, "rb");
+
+  if (fread (wl_buf, 1, wl_len, fp) != wl_len)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    fclose (fp);
+
+    free (wl_buf);
+
+    return -1;
+  }
+
+  fclose (fp);
+
+  #else
+
+  char *wl_buf = (char *) mmap (NULL, wl_len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (wl_buf == MAP_FAILED)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    close (fd);
+
+    return -1;
+  }
+
+  madvise (wl_buf, wl_len, MADV_SEQUENTIAL);
+
+  close (fd);
+
+  #endif
+
+  wl_load_buf (wl_buf, wl_len, db_entries, threads, weighted);
+
+  #ifdef WINDOWS
+  free (wl_buf);
+  #else
+  munmap (wl_buf, wl_len);
+  #endif
+
+  return 0;
+}
+
+static void out_emit (out_t *out, const chain_t *chain_buf, const db_entry_t *db_entries, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], char *pw_buf, const int pw_len, u64 iter_cnt)
+{
+  const rules_t *rules = out->rules;
+
+  const u64 rec_len  = (rules) ? rules->rec_max[pw_len] : (u64) rec_len_get (out->format, pw_len);
+  const int hdr_size = rec_hdr_size (out->format);
+
+  while (iter_cnt)
+  {
+    const u64 room = out->size - out->len;
+
+    const u64 outs_room = (room > (u64) hdr_size) ? (room - hdr_size) / rec_len : 0;
+
+    if (outs_room == 0)
+    {
+      out_flush (out);
+
+      continue;
+    }
+
+    const u64 iter_max = MIN (MIN (iter_cnt, outs_room), UINT32_MAX);
+
+    if (rules)
+    {
+      out->len += rules_block_emit (rules, out->format, chain_buf, db_entries, cur_chain_ks_poses, pw_buf, pw_len, iter_max, out->buf + out->len);
+    }
+    else
+    {
+      const u64 len = rec_block_emit (out->format, chain_buf, db_entries, cur_chain_ks_poses, pw_buf, pw_len, iter_max, out->buf + out->len);
+
+      out->len += (out->dedup) ? dedup_block (out->dedup, out->format, pw_len, out->buf + out->len, len) : len;
+    }
+
+    out->units += (rules) ? iter_max * rules->rules_cnt : iter_max;
+
+    iter_cnt -= iter_max;
+  }
+}
+
+static void job_render (job_t *job, const db_entry_t *db_entries, const int format, const rules_t *rules)
+{
+  char *out_buf = job->buf;
+
+  u64 out_len = 0;
+
+  for (int segs_idx = 0; segs_idx < job->segs_cnt; segs_idx++)
+  {
+    seg_t *seg = &job->segs_buf[segs_idx];
+
+    char pw_buf[OUT_SLACK];
+
+    if (rules)
+    {
+      rec_tpl_init (OUT_FORMAT_TEXT, seg, db_entries, pw_buf);
+
+      out_len += rules_block_emit (rules, format, &seg->chain_buf, db_entries, seg->cur_chain_ks_poses, pw_buf, seg->pw_len, seg->iter_cnt, out_buf + out_len);
+    }
+    else
+    {
+      rec_tpl_init (format, seg, db_entries, pw_buf);
+
+      out_len += rec_block_emit (format, &seg->chain_buf, db_entries, seg->cur_chain_ks_poses, pw_buf, seg->pw_len, seg->iter_cnt, out_buf + out_len);
+    }
+  }
+
+  job->len = out_len;
+}
+
+static void *pool_worker (void *p)
+{
+  pool_t *pool = (pool_t *) p;
+
+  pthread_mutex_lock (&pool->mux);
+
+  while (1)
+  {
+    job_t *job = &pool->jobs_buf[pool->jobs_take];
+
+    if (job->state != JOB_READY)
+    {
+      if (pool->shutdown) break;
+
+      pthread_cond_wait (&pool->cond_ready, &pool->mux);
+
+      continue;
+    }
+
+    job->state = JOB_BUSY;
+
+    pool->jobs_take = (pool->jobs_take + 1) % pool->jobs_cnt;
+
+    pthread_mutex_unlock (&pool->mux);
+
+    job_render (job, pool->db_entries, pool->format, pool->rules);
+
+    pthread_mutex_lock (&pool->mux);
+
+    job->state = JOB_DONE;
+
+    pthread_cond_broadcast (&pool->cond_done);
+  }
+
+  pthread_mutex_unlock (&pool->mux);
+
+  return NULL;
+}
+
+static void pool_init (pool_t *pool, const int threads_cnt, const db_entry_t *db_entries, const int format, const rules_t *rules, const u64 buf_size)
+{
+  pool->threads_cnt = threads_cnt;
+  pool->jobs_cnt    = threads_cnt * JOBS_PER_THR;
+  pool->jobs_fill   = 0;
+  pool->jobs_take   = 0;
+  pool->db_entries  = db_entries;
+  pool->format      = format;
+  pool->rules       = rules;
+  pool->shutdown    = 0;
+
+  // a written job swaps its buffer for a spare output buffer, so they are all as big. That is
+  // big enough for all rule results of one candidate
+
+  pool->job_buf_size = buf_size;
+
+  pool->threads_buf = (pthread_t *) calloc (pool->threads_cnt, sizeof (pthread_t));
+  pool->jobs_buf    = (job_t *)     calloc (pool->jobs_cnt,    sizeof (job_t));
+
+  if ((pool->threads_buf == NULL) || (pool->jobs_buf == NULL))
+  {
+    fprintf (stderr, "Out of memory trying to allocate thread pool!\n");
+
+    exit (-1);
+  }
+
+  for (int jobs_idx = 0; jobs_idx < pool->jobs_cnt; jobs_idx++)
+  {
+    job_t *job = &pool->jobs_buf[jobs_idx];
+
+    job->segs_buf = (seg_t *) malloc (JOB_SEGS_MAX * sizeof (seg_t));
+    job->buf      = (char *)  malloc (pool->job_buf_size + OUT_SLACK);
+
+    if ((job->segs_buf == NULL) || (job->buf == NULL))
+    {
+      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+               (size_t) pool->job_buf_size);
+
+      exit (-1);
+    }
+  }
+
+  pthread_mutex_init (&pool->mux, NULL);
+
+  pthread_cond_init (&pool->cond_ready, NULL);
+  pthread_cond_init (&pool->cond_done,  NULL);
+
+  for (int threads_idx = 0; threads_idx < pool->threads_cnt; threads_idx++)
+  {
+    pthread_create (&pool->threads_buf[threads_idx], NULL, pool_worker, pool);
+  }
+}
+
+static job_t *pool_job_get (pool_t *pool, out_t *out)
+{
+  job_t *job = &pool->jobs_buf[pool->jobs_fill];
+
+  pthread_mutex_lock (&pool->mux);
+
+  while ((job->state == JOB_READY) || (job->state == JOB_BUSY))
+  {
+    pthread_cond_wait (&pool->cond_done, &pool->mux);
+  }
+
+  pthread_mutex_unlock (&pool->mux);
+
+  if (job->state == JOB_FREE) return job;
+
+  if (out->dedup) dedup_job (out->dedup, job, out->format);
+
+  job->buf = out_swap (out, job->buf, job->len, job->units);
+
+  job->segs_cnt  = 0;
+  job->units     = 0;
+  job->len       = 0;
+  job->lens_done = 0;
+  job->state     = JOB_FREE;
+
+  return job;
+}
+
+static void pool_job_submit (pool_t *pool)
+{
+  job_t *job = &pool->jobs_buf[pool->jobs_fill];
+
+  if (job->segs_cnt == 0) return;
+
+  pthread_mutex_lock (&pool->mux);
+
+  job->state = JOB_READY;
+
+  pool->jobs_fill = (pool->jobs_fill + 1) % pool->jobs_cnt;
+
+  pthread_cond_broadcast (&pool->cond_ready);
+
+  pthread_mutex_unlock (&pool->mux);
+}
+
+static void pool_push (pool_t *pool, out_t *out, const chain_t *chain_buf, const int pw_len, u64 cur_chain_ks_poses[CHAIN_ELEMS_MAX], u64 iter_cnt)
+{
+  const db_entry_t *db_entries = pool->db_entries;
+
+  const u64 rec_len  = (pool->rules) ? pool->rules->rec_max[pw_len] : (u64) rec_len_get (pool->format, pw_len);
+  const int hdr_size = rec_hdr_size (pool->format);
+
+  while (iter_cnt)
+  {
+    job_t *job = pool_job_get (pool, out);
+
+    const u64 room = pool->job_buf_size - job->len;
+
+    const u64 outs_room = (room > (u64) hdr_size) ? (room - hdr_size) / rec_len : 0;
+
+    if ((outs_room == 0) || (job->segs_cnt == JOB_SEGS_MAX))
+    {
+      pool_job_submit (pool);
+
+      continue;
+    }
+
+    const u64 iter_max = MIN (iter_cnt, outs_room);
+
+    seg_t *seg = &job->segs_buf[job->segs_cnt];
+
+    seg->chain_buf = *chain_buf;
+    seg->pw_len    = pw_len;
+    seg->iter_cnt  = iter_max;
+
+    memcpy (seg->cur_chain_ks_poses, cur_chain_ks_poses, CHAIN_ELEMS_MAX * sizeof (u64));
+
+    job->segs_cnt++;
+
+    // job->len is the planned size until the job is rendered
+
+    job->len += hdr_size + iter_max * rec_len;
+
+    job->units += (pool->rules) ? iter_max * pool->rules->rules_cnt : iter_max;
+
+    chain_ks_poses_add (chain_buf, db_entries, cur_chain_ks_poses, iter_max);
+
+    iter_cnt -= iter_max;
+  }
+}
+
+static void pool_drain (pool_t *pool, out_t *out)
+{
+  // write all pending jobs, the ring ends up where it started
+
+  pool_job_submit (pool);
+
+  for (int jobs_idx = 0; jobs_idx < pool->jobs_cnt; jobs_idx++)
+  {
+    pool_job_get (pool, out);
+
+    pool->jobs_fill = (pool->jobs_fill + 1) % pool->jobs_cnt;
+  }
+}
+
+static void pool_finish (pool_t *pool, out_t *out)
+{
+  pool_drain (pool, out);
+
+  pthread_mutex_lock (&pool->mux);
+
+  pool->shutdown = 1;
+
+  pthread_cond_broadcast (&pool->cond_ready);
+
+  pthread_mutex_unlock (&pool->mux);
+
+  for (int threads_idx = 0; threads_idx < pool->threads_cnt; threads_idx++)
+  {
+    pthread_join (pool->threads_buf[threads_idx], NULL);
+  }
+
+  for (int jobs_idx = 0; jobs_idx < pool->jobs_cnt; jobs_idx++)
+  {
+    job_t *job = &pool->jobs_buf[jobs_idx];
+
+    free (job->segs_buf);
+    free (job->buf);
+  }
+
+  pthread_mutex_destroy (&pool->mux);
+
+  pthread_cond_destroy (&pool->cond_ready);
+  pthread_cond_destroy (&pool->cond_done);
+
+  free (pool->jobs_buf);
+  free (pool->threads_buf);
+}
+
+static void split_loops_bytes (mpz_t bytes, mpz_t ks_pos, const mpz_t main_loops, const pw_order_t *pw_orders, const int order_cnt, const u64 *wordlen_dist, mpz_t *pw_ks_cnt, const u64 *rec_lens, mpz_t tmp)
+{
+  // output bytes and candidates of the first main_loops main loops
+
+  mpz_set_si (bytes,  0);
+  mpz_set_si (ks_pos, 0);
+
+  for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+  {
+    const int pw_len = pw_orders[order_pos].len;
+
+    mpz_mul_ui (tmp, main_loops, wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, pw_ks_cnt[pw_len]) > 0) mpz_set (tmp, pw_ks_cnt[pw_len]);
+
+    mpz_addmul_ui (bytes, tmp, rec_lens[pw_len]);
+
+    mpz_add (ks_pos, ks_pos, tmp);
+  }
+}
+
+static void split_pos_by_bytes (mpz_t ks_pos, const mpz_t bytes_max, const pw_order_t *pw_orders, const int order_cnt, const u64 *wordlen_dist, mpz_t *pw_ks_cnt, const u64 *rec_lens)
+{
+  // the last position with at most bytes_max bytes of output in front of it, rec_lens are the bytes per candidate
+
+  mpz_t lo;    mpz_init_set_si (lo, 0);
+  mpz_t hi;    mpz_init_set_si (hi, 0);
+  mpz_t mid;   mpz_init (mid);
+  mpz_t bytes; mpz_init (bytes);
+  mpz_t tmp;   mpz_init (tmp);
+
+  for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+  {
+    const int pw_len = pw_orders[order_pos].len;
+
+    mpz_cdiv_q_ui (tmp, pw_ks_cnt[pw_len], wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, hi) > 0) mpz_set (hi, tmp);
+  }
+
+  // binary search the main loops that fit
+
+  while (mpz_cmp (lo, hi) < 0)
+  {
+    mpz_add (mid, lo, hi);
+    mpz_add_ui (mid, mid, 1);
+    mpz_fdiv_q_2exp (mid, mid, 1);
+
+    split_loops_bytes (bytes, ks_pos, mid, pw_orders, order_cnt, wordlen_dist, pw_ks_cnt, rec_lens, tmp);
+
+    if (mpz_cmp (bytes, bytes_max) <= 0)
+    {
+      mpz_set (lo, mid);
+    }
+    else
+    {
+      mpz_sub_ui (hi, mid, 1);
+    }
+  }
+
+  split_loops_bytes (bytes, ks_pos, lo, pw_orders, order_cnt, wordlen_dist, pw_ks_cnt, rec_lens, tmp);
+
+  // walk the next main loop in output order
+
+  for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+  {
+    const int pw_len = pw_orders[order_pos].len;
+
+    mpz_mul_ui (tmp, lo, wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, pw_ks_cnt[pw_len]) >= 0) continue;
+
+    mpz_sub (tmp, pw_ks_cnt[pw_len], tmp);
+
+    if (mpz_cmp_ui (tmp, wordlen_dist[pw_len]) > 0) mpz_set_ui (tmp, wordlen_dist[pw_len]);
+
+    mpz_mul_ui (mid, tmp, rec_lens[pw_len]);
+
+    mpz_add (mid, mid, bytes);
+
+    if (mpz_cmp (mid, bytes_max) > 0)
+    {
+      mpz_sub (tmp, bytes_max, bytes);
+
+      mpz_fdiv_q_ui (tmp, tmp, rec_lens[pw_len]);
+
+      mpz_add (ks_pos, ks_pos, tmp);
+
+      break;
+    }
+
+    mpz_set (bytes, mid);
+
+    mpz_add (ks_pos, ks_pos, tmp);
+  }
+
+  mpz_clear (lo);
+  mpz_clear (hi);
+  mpz_clear (mid);
+  mpz_clear (bytes);
+  mpz_clear (tmp);
+}
+
+static void split_len_cnts (mpz_t *len_cnts, const mpz_t ks_pos, const pw_order_t *pw_orders, const int order_cnt, const u64 *wordlen_dist, mpz_t *pw_ks_cnt)
+{
+  // the candidates of each length in front of ks_pos, like split_pos_by_bytes () with one byte
+  // per candidate
+
+  u64 ones[OUT_LEN_MAX + 1];
+
+  for (int pw_len = 0; pw_len <= OUT_LEN_MAX; pw_len++) ones[pw_len] = 1;
+
+  mpz_t lo;    mpz_init_set_si (lo, 0);
+  mpz_t hi;    mpz_init_set_si (hi, 0);
+  mpz_t mid;   mpz_init (mid);
+  mpz_t pos;   mpz_init (pos);
+  mpz_t bytes; mpz_init (bytes);
+  mpz_t tmp;   mpz_init (tmp);
+
+  for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+  {
+    const int pw_len = pw_orders[order_pos].len;
+
+    mpz_cdiv_q_ui (tmp, pw_ks_cnt[pw_len], wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, hi) > 0) mpz_set (hi, tmp);
+  }
+
+  while (mpz_cmp (lo, hi) < 0)
+  {
+    mpz_add (mid, lo, hi);
+    mpz_add_ui (mid, mid, 1);
+    mpz_fdiv_q_2exp (mid, mid, 1);
+
+    split_loops_bytes (bytes, pos, mid, pw_orders, order_cnt, wordlen_dist, pw_ks_cnt, ones, tmp);
+
+    if (mpz_cmp (pos, ks_pos) <= 0)
+    {
+      mpz_set (lo, mid);
+    }
+    else
+    {
+      mpz_sub_ui (hi, mid, 1);
+    }
+  }
+
+  split_loops_bytes (bytes, pos, lo, pw_orders, order_cnt, wordlen_dist, pw_ks_cnt, ones, tmp);
+
+  // pos is what is left in the next main loop
+
+  mpz_sub (pos, ks_pos, pos);
+
+  for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+  {
+    const int pw_len = pw_orders[order_pos].len;
+
+    mpz_mul_ui (tmp, lo, wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, pw_ks_cnt[pw_len]) >= 0)
+    {
+      mpz_set (len_cnts[pw_len], pw_ks_cnt[pw_len]);
+
+      continue;
+    }
+
+    mpz_set (len_cnts[pw_len], tmp);
+
+    mpz_sub (tmp, pw_ks_cnt[pw_len], tmp);
+
+    if (mpz_cmp_ui (tmp, wordlen_dist[pw_len]) > 0) mpz_set_ui (tmp, wordlen_dist[pw_len]);
+
+    if (mpz_cmp (tmp, pos) > 0) mpz_set (tmp, pos);
+
+    mpz_add (len_cnts[pw_len], len_cnts[pw_len], tmp);
+
+    mpz_sub (pos, pos, tmp);
+  }
+
+  mpz_clear (lo);
+  mpz_clear (hi);
+  mpz_clear (mid);
+  mpz_clear (pos);
+  mpz_clear (bytes);
+  mpz_clear (tmp);
+}
+
+static void split_len_range (double *cands, const engine_t *engine, const mpz_t ks_beg, const mpz_t ks_end)
+{
+  // the candidates of each length from ks_beg to ks_end
+
+  mpz_t cnts_beg[OUT_LEN_MAX + 1];
+  mpz_t cnts_end[OUT_LEN_MAX + 1];
+
+  for (int pw_len = 0; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    mpz_init (cnts_beg[pw_len]);
+    mpz_init (cnts_end[pw_len]);
+  }
+
+  split_len_cnts (cnts_beg, ks_beg, engine->pw_orders, engine->order_cnt, engine->wordlen_dist, (mpz_t *) engine->pw_ks_cnt);
+  split_len_cnts (cnts_end, ks_end, engine->pw_orders, engine->order_cnt, engine->wordlen_dist, (mpz_t *) engine->pw_ks_cnt);
+
+  for (int pw_len = 0; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    mpz_sub (cnts_end[pw_len], cnts_end[pw_len], cnts_beg[pw_len]);
+
+    cands[pw_len] = mpz_get_d (cnts_end[pw_len]);
+
+    mpz_clear (cnts_beg[pw_len]);
+    mpz_clear (cnts_end[pw_len]);
+  }
+}
+
+static u64 rss_peak_kb (void)
+{
+  #ifdef WINDOWS
+
+  return 0;
+
+  #else
+
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) == -1) return 0;
+
+  #ifdef OSX
+  return (u64) usage.ru_maxrss / 1024;
+  #else
+  return (u64) usage.ru_maxrss;
+  #endif
+
+  #endif
+}
+
+static void timings_mark (void *p, const char *phase)
+{
+  timings_t *timings = (timings_t *) p;
+
+  if (timings->cnt == TIMINGS_MAX) return;
+
+  timings->names[timings->cnt]  = phase;
+  timings->secs[timings->cnt]   = time_elapsed (&timings->time_last);
+  timings->rss_kb[timings->cnt] = rss_peak_kb ();
+
+  timings->cnt++;
+
+  clock_gettime (CLOCK_MONOTONIC, &timings->time_last);
+}
+
+static void timings_report (const timings_t *timings, const engine_t *engine, const int chains)
+{
+  const db_entry_t *db_entries = engine->db_entries;
+
+  // lengths with elements or chains, parts and chains exist only after engine_chains () and are
+  // left out before
+
+  const int len_max = MAX (IN_LEN_MAX, engine->pw_max);
+
+  if (timings->json)
+  {
+    fprintf (stderr, "{\"phases\":[");
+
+    for (int idx = 0; idx < timings->cnt; idx++)
+    {
+      fprintf (stderr, "%s{\"phase\":\"%s\",\"seconds\":%.6f,\"peak_rss_kb\":%llu}", (idx) ? "," : "", timings->names[idx], timings->secs[idx], (unsigned long long) timings->rss_kb[idx]);
+    }
+
+    fprintf (stderr, "],\"lengths\":[");
+
+    int sep = 0;
+
+    for (int pw_len = IN_LEN_MIN; pw_len <= len_max; pw_len++)
+    {
+      const db_entry_t *db_entry = &db_entries[pw_len];
+
+      if ((db_entry->elems_cnt == 0) && (db_entry->chains_cnt == 0)) continue;
+
+      fprintf (stderr, "%s{\"len\":%d,\"elems\":%llu", (sep) ? "," : "", pw_len, (unsigned long long) db_entry->elems_cnt);
+
+      if (chains) fprintf (stderr, ",\"parts\":%d,\"chains\":%llu", db_entry->parts_cnt, (unsigned long long) db_entry->chains_cnt);
+
+      fprintf (stderr, "}");
+
+      sep = 1;
+    }
+
+    fprintf (stderr, "]}\n");
+
+    return;
+  }
+
+  fprintf (stderr, "%-12s %10s %14s\n", "Phase", "Seconds", "Peak RSS kB");
+
+  double secs_sum = 0;
+
+  for (int idx = 0; idx < timings->cnt; idx++)
+  {
+    fprintf (stderr, "%-12s %10.3f %14llu\n", timings->names[idx], timings->secs[idx], (unsigned long long) timings->rss_kb[idx]);
+
+    secs_sum += timings->secs[idx];
+  }
+
+  fprintf (stderr, "%-12s %10.3f\n", "total", secs_sum);
+
+  if (chains) fprintf (stderr, "\n%-12s %14s %10s %14s\n", "Length", "Elements", "Parts", "Chains");
+  else        fprintf (stderr, "\n%-12s %14s\n",           "Length", "Elements");
+
+  for (int pw_len = IN_LEN_MIN; pw_len <= len_max; pw_len++)
+  {
+    const db_entry_t *db_entry = &db_entries[pw_len];
+
+    if ((db_entry->elems_cnt == 0) && (db_entry->chains_cnt == 0)) continue;
+
+    if (chains) fprintf (stderr, "%-12d %14llu %10d %14llu\n", pw_len, (unsigned long long) db_entry->elems_cnt, db_entry->parts_cnt, (unsigned long long) db_entry->chains_cnt);
+    else        fprintf (stderr, "%-12d %14llu\n",             pw_len, (unsigned long long) db_entry->elems_cnt);
+  }
+}
+
+static void bench_add (bench_t *bench, const seg_t *seg)
+{
+  // with --rules a candidate counts once per rule and the bytes are the upper bound
+
+  const u64 cnt   = seg->iter_cnt * bench->cnt_mul;
+  const u64 bytes = seg->iter_cnt * bench->rec_lens[seg->pw_len];
+
+  bench->pw_cnts[seg->pw_len]  += cnt;
+  bench->pw_bytes[seg->pw_len] += bytes;
+
+  bench->elem_cnts[seg->chain_buf.cnt]  += cnt;
+  bench->elem_bytes[seg->chain_buf.cnt] += bytes;
+
+  const double elapsed = time_elapsed (&bench->time_last);
+
+  clock_gettime (CLOCK_MONOTONIC, &bench->time_last);
+
+  bench->pw_times[seg->pw_len]          += elapsed;
+  bench->elem_times[seg->chain_buf.cnt] += elapsed;
+}
+
+static void bench_line_print (const char *name, const int val, const u64 cnt, const u64 bytes, const u64 total_cnt, const double elapsed)
+{
+  char label[32];
+
+  if (val) snprintf (label, sizeof (label), "%s %d", name, val);
+  else     snprintf (label, sizeof (label), "%s", name);
+
+  printf ("%-12s  %20llu  %6.2f%%  %12.3f Mc/s  %10.3f MB/s\n", label,
+          (unsigned long long) cnt,
+          (total_cnt) ? (double) cnt * 100 / total_cnt : 0.0,
+          (elapsed > 0) ? (double) cnt   / elapsed / 1e6 : 0.0,
+          (elapsed > 0) ? (double) bytes / elapsed / 1e6 : 0.0);
+}
+
+static void bench_report (const bench_t *bench, const double elapsed)
+{
+  // the rates per length and element count are over the time spent on them
+
+  u64 total_cnt   = 0;
+  u64 total_bytes = 0;
+
+  for (int pw_len = 1; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    total_cnt   += bench->pw_cnts[pw_len];
+    total_bytes += bench->pw_bytes[pw_len];
+  }
+
+  printf ("Benchmark: %llu candidates, %llu bytes in %.2f seconds\n", (unsigned long long) total_cnt, (unsigned long long) total_bytes, elapsed);
+  printf ("\n");
+  printf ("%-12s  %20s  %7s  %17s  %15s\n", "", "Candidates", "Share", "Speed", "Bytes");
+
+  bench_line_print ("Total", 0, total_cnt, total_bytes, total_cnt, elapsed);
+
+  printf ("\n");
+
+  for (int pw_len = 1; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    const u64 cnt = bench->pw_cnts[pw_len];
+
+    if (cnt == 0) continue;
+
+    bench_line_print ("Length", pw_len, cnt, bench->pw_bytes[pw_len], total_cnt, bench->pw_times[pw_len]);
+  }
+
+  printf ("\n");
+
+  for (int elem_cnt = 1; elem_cnt <= CHAIN_ELEMS_MAX; elem_cnt++)
+  {
+    const u64 cnt = bench->elem_cnts[elem_cnt];
+
+    if (cnt == 0) continue;
+
+    bench_line_print ("Elements", elem_cnt, cnt, bench->elem_bytes[elem_cnt], total_cnt, bench->elem_times[elem_cnt]);
+  }
+}
+
+static void ks_pos_get (mpz_t ks_pos, const engine_t *engine, const u64 ks_mul, const mpz_t ks_end)
+{
+  // position in the output, with --rules each candidate counts once per rule
+
+  engine_pos_get (engine, ks_pos);
+
+  mpz_mul_ui (ks_pos, ks_pos, ks_mul);
+
+  if (mpz_cmp (ks_pos, ks_end) > 0) mpz_set (ks_pos, ks_end);
+}
+
+static void out_rules_cand (out_t *out, engine_t *engine, const int rule_beg, const int rule_end)
+{
+  // a candidate cut by --skip or --limit gets only some of its rules
+
+  seg_t seg;
+
+  engine_next (engine, &seg, 1);
+
+  char pw_buf[OUT_SLACK];
+
+  rec_tpl_init (OUT_FORMAT_TEXT, &seg, engine->db_entries, pw_buf);
+
+  if ((out->size - out->len) < out->rules->rec_max[seg.pw_len]) out_flush (out);
+
+  out->len += rules_emit (out->rules, out->format == OUT_FORMAT_LENPREFIX, pw_buf, seg.pw_len, rule_beg, rule_end, out->buf + out->len);
+
+  out->units += rule_end - rule_beg;
+}
+
+static volatile sig_atomic_t restore_stop = 0;
+
+static void restore_signal (int signum)
+{
+  restore_stop = signum;
+}
+
+static u64 restore_fingerprint (const db_entry_t *db_entries)
+{
+  // the wordlist can come from stdin, so hash what was loaded
+
+  u64 fingerprint = 0xcbf29ce484222325ULL;
+
+  for (int elem_len = IN_LEN_MIN; elem_len <= IN_LEN_MAX; elem_len++)
+  {
+    const db_entry_t *db_entry = &db_entries[elem_len];
+
+    fingerprint = (fingerprint ^ db_entry->elems_cnt) * 0x100000001b3ULL;
+
+    for (u64 elems_idx = 0; elems_idx < db_entry->elems_cnt; elems_idx++)
+    {
+      fingerprint = (fingerprint ^ elem_hash (&db_entry->elems_buf[elems_idx])) * 0x100000001b3ULL;
+
+      if (db_entry->weights_buf) fingerprint = (fingerprint ^ db_entry->weights_buf[elems_idx]) * 0x100000001b3ULL;
+    }
+  }
+
+  return fingerprint;
+}
+
+static int restore_read (const char *restore_file, restore_t *restore)
+{
+  FILE *fp = fopen (restore_file, "rb");
+
+  if (fp == NULL) return (-1);
+
+  int version = 0;
+
+  unsigned long long fingerprint = 0;
+
+  int rc = 0;
+
+  rc += fscanf (fp, "pp-restore %d\n", &version);
+  rc += fscanf (fp, "fingerprint %llx\n", &fingerprint);
+  rc += fscanf (fp, "options %d %d %d %d %d %d\n", &restore->pw_min, &restore->pw_max, &restore->elem_cnt_min, &restore->elem_cnt_max, &restore->wl_dist_len, &restore->dedup_input);
+
+  rc += gmp_fscanf (fp, "skip %Zd\n",  restore->skip);
+  rc += gmp_fscanf (fp, "limit %Zd\n", restore->limit);
+  rc += gmp_fscanf (fp, "pos %Zd\n",   restore->pos);
+
+  fclose (fp);
+
+  if ((rc != 11) || (version != VERSION_BIN))
+  {
+    fprintf (stderr, "%s: Invalid restore file\n", restore_file);
+
+    return (-2);
+  }
+
+  restore->fingerprint = fingerprint;
+
+  return 0;
+}
+
+static FILE *file_tmp_open (const char *file, char **tmp_file)
+{
+  // write a new file and rename it over the old one, a kill in between leaves the old one intact
+
+  *tmp_file = (char *) malloc (strlen (file) + 5);
+
+  sprintf (*tmp_file, "%s.tmp", file);
+
+  FILE *fp = fopen (*tmp_file, "wb");
+
+  if (fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", *tmp_file, strerror (errno));
+
+    free (*tmp_file);
+  }
+
+  return fp;
+}
+
+static int file_tmp_commit (FILE *fp, const char *file, char *tmp_file)
+{
+  const int err = (fflush (fp) != 0) | (fclose (fp) != 0);
+
+  #ifdef WINDOWS
+  remove (file);
+  #endif
+
+  if (err || rename (tmp_file, file))
+  {
+    fprintf (stderr, "%s: %s\n", file, strerror (errno));
+
+    free (tmp_file);
+
+    return (-1);
+  }
+
+  free (tmp_file);
+
+  return 0;
+}
+
+static int restore_write (const char *restore_file, const restore_t *restore)
+{
+  char *tmp_file = NULL;
+
+  FILE *fp = file_tmp_open (restore_file, &tmp_file);
+
+  if (fp == NULL) return (-1);
+
+  fprintf (fp, "pp-restore %d\n", VERSION_BIN);
+  fprintf (fp, "fingerprint %016llx\n", (unsigned long long) restore->fingerprint);
+  fprintf (fp, "options %d %d %d %d %d %d\n", restore->pw_min, restore->pw_max, restore->elem_cnt_min, restore->elem_cnt_max, restore->wl_dist_len, restore->dedup_input);
+
+  gmp_fprintf (fp, "skip %Zd\n",  restore->skip);
+  gmp_fprintf (fp, "limit %Zd\n", restore->limit);
+  gmp_fprintf (fp, "pos %Zd\n",   restore->pos);
+
+  return file_tmp_commit (fp, restore_file, tmp_file);
+}
+
+static int db_cache_hash (const char *wordlist_file, u64 *hash)
+{
+  FILE *fp = fopen (wordlist_file, "rb");
+
+  if (fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    return -1;
+  }
+
+  char *buf = (char *) malloc (DB_CACHE_READ);
+
+  if (buf == NULL)
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) DB_CACHE_READ);
+
+    exit (-1);
+  }
+
+  // 8 bytes at a time, the last word of a read is padded with zeros
+
+  u64 h = 0xcbf29ce484222325ULL;
+
+  size_t len;
+
+  while ((len = fread (buf, 1, DB_CACHE_READ, fp)) > 0)
+  {
+    for (size_t pos = 0; pos < len; pos += 8)
+    {
+      u64 word = 0;
+
+      memcpy (&word, buf + pos, MIN (len - pos, 8));
+
+      h = (h ^ word) * 0x100000001b3ULL;
+    }
+
+    h = (h ^ len) * 0x100000001b3ULL;
+  }
+
+  const int err = ferror (fp);
+
+  fclose (fp);
+
+  free (buf);
+
+  if (err)
+  {
+    fprintf (stderr, "%s: Read error\n", wordlist_file);
+
+    return -1;
+  }
+
+  *hash = h;
+
+  return 0;
+}
+
+static int db_cache_key (const char *wordlist_file, const int opts, db_cache_t *db_cache)
+{
+  struct stat st;
+
+  if (stat (wordlist_file, &st) == -1)
+  {
+    fprintf (stderr, "%s: %s\n", wordlist_file, strerror (errno));
+
+    return -1;
+  }
+
+  memset (db_cache, 0, sizeof (db_cache_t));
+
+  db_cache->magic    = DB_CACHE_MAGIC;
+  db_cache->version  = DB_CACHE_VERSION;
+  db_cache->wl_dev   = st.st_dev;
+  db_cache->wl_ino   = st.st_ino;
+  db_cache->wl_size  = st.st_size;
+  db_cache->wl_mtime = st.st_mtime;
+  db_cache->wl_ctime = st.st_ctime;
+  db_cache->opts     = opts;
+
+  #ifdef LINUX
+  db_cache->wl_mtime_ns = st.st_mtim.tv_nsec;
+  #endif
+
+  #ifdef OSX
+  db_cache->wl_mtime_ns = st.st_mtimespec.tv_nsec;
+  #endif
+
+  // the stat fields alone don't tell two lists apart that were written in the same second
+
+  if (db_cache_hash (wordlist_file, &db_cache->wl_hash) == -1) return -1;
+
+  return 0;
+}
+
+static int db_cache_load (const char *cache_file, db_cache_t *db_cache, engine_t *engine, char **cache_buf, u64 *cache_len)
+{
+  // returns 1 if the image matches the key in db_cache and its elements are in place, a missing
+  // or stale image is not an error
+
+  int fd = open (cache_file, O_RDONLY);
+
+  if (fd == -1) return 0;
+
+  struct stat st;
+
+  if ((fstat (fd, &st) == -1) || ((u64) st.st_size < sizeof (db_cache_t)))
+  {
+    close (fd);
+
+    return 0;
+  }
+
+  const u64 len = st.st_size;
+
+  #ifdef WINDOWS
+
+  char *buf = (char *) malloc (len);
+
+  if (buf == NULL)
+  {
+    fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) len);
+
+    close (fd);
+
+    return 0;
+  }
+
+  FILE *fp = fdopen (fd, "rb");
+
+  const int err = (fread (buf, 1, len, fp) != len);
+
+  fclose (fp);
+
+  if (err)
+  {
+    free (buf);
+
+    return 0;
+  }
+
+  #else
+
+  char *buf = (char *) mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close (fd);
+
+  if (buf == MAP_FAILED) return 0;
+
+  #endif
+
+  const db_cache_t *hdr = (const db_cache_t *) buf;
+
+  int valid = (hdr->magic       == db_cache->magic)
+           && (hdr->version     == db_cache->version)
+           && (hdr->wl_dev      == db_cache->wl_dev)
+           && (hdr->wl_ino      == db_cache->wl_ino)
+           && (hdr->wl_size     == db_cache->wl_size)
+           && (hdr->wl_mtime    == db_cache->wl_mtime)
+           && (hdr->wl_mtime_ns == db_cache->wl_mtime_ns)
+           && (hdr->wl_ctime    == db_cache->wl_ctime)
+           && (hdr->wl_hash     == db_cache->wl_hash)
+           && (hdr->opts        == db_cache->opts)
+           && (hdr->file_size   == len);
+
+  for (int input_len = IN_LEN_MIN; valid && (input_len <= IN_LEN_MAX); input_len++)
+  {
+    const u64 elems_cnt = hdr->elems_cnts[input_len];
+
+    if (elems_cnt > len / sizeof (elem_t))                                           valid = 0;
+    else if (hdr->elems_offs[input_len] > len - elems_cnt * sizeof (elem_t))         valid = 0;
+    else if (hdr->weights_offs[input_len] > len - elems_cnt * sizeof (u64))          valid = 0;
+    else if (hdr->masks_offs[input_len][CLASS_MASKS] != elems_cnt)                   valid = 0;
+  }
+
+  if (valid == 0)
+  {
+    #ifdef WINDOWS
+    free (buf);
+    #else
+    munmap (buf, len);
+    #endif
+
+    return 0;
+  }
+
+  memcpy (db_cache, hdr, sizeof (db_cache_t));
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    db_entry_t *db_entry = &engine->db_entries[input_len];
+
+    db_entry->elems_cnt   = hdr->elems_cnts[input_len];
+    db_entry->elems_alloc = hdr->elems_cnts[input_len];
+    db_entry->elems_buf   = (elem_t *) (buf + hdr->elems_offs[input_len]);
+    db_entry->weights_buf = (hdr->weights_offs[input_len]) ? (u64 *) (buf + hdr->weights_offs[input_len]) : NULL;
+
+    memcpy (db_entry->masks_offs, hdr->masks_offs[input_len], sizeof (db_entry->masks_offs));
+  }
+
+  engine->elems_mapped = 1;
+
+  *cache_buf = buf;
+  *cache_len = len;
+
+  return 1;
+}
+
+static void db_cache_pad (FILE *fp, u64 *pos)
+{
+  static const char zeros[DB_CACHE_ALIGN] = { 0 };
+
+  const u64 pad = (DB_CACHE_ALIGN - (*pos % DB_CACHE_ALIGN)) % DB_CACHE_ALIGN;
+
+  fwrite (zeros, 1, pad, fp);
+
+  *pos += pad;
+}
+
+static int db_cache_write (const char *cache_file, db_cache_t *db_cache, const engine_t *engine)
+{
+  // the key, fingerprint and counts before dedup are already in db_cache
+
+  const db_entry_t *db_entries = engine->db_entries;
+
+  u64 pos = sizeof (db_cache_t);
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    const db_entry_t *db_entry = &db_entries[input_len];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    db_cache->elems_cnts[input_len] = elems_cnt;
+
+    memcpy (db_cache->masks_offs[input_len], db_entry->masks_offs, sizeof (db_entry->masks_offs));
+
+    pos += (DB_CACHE_ALIGN - (pos % DB_CACHE_ALIGN)) % DB_CACHE_ALIGN;
+
+    db_cache->elems_offs[input_len] = pos;
+
+    pos += elems_cnt * sizeof (elem_t);
+
+    db_cache->weights_offs[input_len] = 0;
+
+    if (db_entry->weights_buf == NULL) continue;
+
+    pos += (DB_CACHE_ALIGN - (pos % DB_CACHE_ALIGN)) % DB_CACHE_ALIGN;
+
+    db_cache->weights_offs[input_len] = pos;
+
+    pos += elems_cnt * sizeof (u64);
+  }
+
+  db_cache->file_size = pos;
+
+  char *tmp_file;
+
+  FILE *fp = file_tmp_open (cache_file, &tmp_file);
+
+  if (fp == NULL) return -1;
+
+  pos = sizeof (db_cache_t);
+
+  fwrite (db_cache, sizeof (db_cache_t), 1, fp);
+
+  for (int input_len = IN_LEN_MIN; input_len <= IN_LEN_MAX; input_len++)
+  {
+    const db_entry_t *db_entry = &db_entries[input_len];
+
+    const u64 elems_cnt = db_entry->elems_cnt;
+
+    db_cache_pad (fp, &pos);
+
+    fwrite (db_entry->elems_buf, sizeof (elem_t), elems_cnt, fp);
+
+    pos += elems_cnt * sizeof (elem_t);
+
+    if (db_entry->weights_buf == NULL) continue;
+
+    db_cache_pad (fp, &pos);
+
+    fwrite (db_entry->weights_buf, sizeof (u64), elems_cnt, fp);
+
+    pos += elems_cnt * sizeof (u64);
+  }
+
+  return file_tmp_commit (fp, cache_file, tmp_file);
+}
+
+static volatile sig_atomic_t status_request = 0;
+
+static void status_signal (int signum)
+{
+  status_request = signum;
+}
+
+static int status_metrics_write (const status_t *status, const int pw_len, const double speed, const double eta, const int done)
+{
+  char *tmp_file = NULL;
+
+  FILE *fp = file_tmp_open (status->metrics_file, &tmp_file);
+
+  if (fp == NULL) return (-1);
+
+  fprintf (fp, "# HELP pp_keyspace Total number of candidates\n");
+  fprintf (fp, "# TYPE pp_keyspace gauge\n");
+  gmp_fprintf (fp, "pp_keyspace %Zd\n", status->ks_cnt);
+  fprintf (fp, "# HELP pp_position Position of the next candidate in the keyspace\n");
+  fprintf (fp, "# TYPE pp_position counter\n");
+  gmp_fprintf (fp, "pp_position %Zd\n", status->ks_pos);
+  fprintf (fp, "# HELP pp_position_end Position where the run ends, --skip plus --limit\n");
+  fprintf (fp, "# TYPE pp_position_end gauge\n");
+  gmp_fprintf (fp, "pp_position_end %Zd\n", status->ks_end);
+  fprintf (fp, "# HELP pp_pw_len Password length currently generated\n");
+  fprintf (fp, "# TYPE pp_pw_len gauge\n");
+  fprintf (fp, "pp_pw_len %d\n", pw_len);
+  fprintf (fp, "# HELP pp_candidates_per_second Average speed since start\n");
+  fprintf (fp, "# TYPE pp_candidates_per_second gauge\n");
+  fprintf (fp, "pp_candidates_per_second %.0f\n", speed);
+  fprintf (fp, "# HELP pp_eta_seconds Estimated time left, -1 if unknown\n");
+  fprintf (fp, "# TYPE pp_eta_seconds gauge\n");
+  fprintf (fp, "pp_eta_seconds %.0f\n", eta);
+  fprintf (fp, "# HELP pp_done 1 if the run is finished\n");
+  fprintf (fp, "# TYPE pp_done gauge\n");
+  fprintf (fp, "pp_done %d\n", done);
+  fprintf (fp, "# HELP pp_last_update_timestamp_seconds Time of this update\n");
+  fprintf (fp, "# TYPE pp_last_update_timestamp_seconds gauge\n");
+  fprintf (fp, "pp_last_update_timestamp_seconds %llu\n", (unsigned long long) time (NULL));
+
+  return file_tmp_commit (fp, status->metrics_file, tmp_file);
+}
+
+static int status_update (status_t *status, const engine_t *engine, const seg_t *seg, const int print, const int done)
+{
+  mpz_ptr tmp = status->tmp;
+
+  ks_pos_get (status->ks_pos, engine, status->ks_mul, status->ks_end);
+
+  const double elapsed = time_elapsed (&status->time_beg);
+
+  mpz_sub (tmp, status->ks_pos, status->pos_beg);
+
+  const double speed = (elapsed > 0) ? mpz_get_d (tmp) / elapsed : 0;
+
+  mpz_sub (tmp, status->ks_end, status->ks_pos);
+
+  const double eta = (speed > 0) ? mpz_get_d (tmp) / speed : -1;
+
+  if (print)
+  {
+    char chain[CHAIN_ELEMS_MAX * 3 + 1] = { 0 };
+
+    for (int idx = 0, off = 0; idx < seg->chain_buf.cnt; idx++)
+    {
+      off += sprintf (chain + off, (idx) ? "+%d" : "%d", seg->chain_buf.buf[idx]);
+    }
+
+    char eta_buf[64] = "unknown";
+
+    if (eta >= 0)
+    {
+      const u64 secs = (u64) eta;
+
+      snprintf (eta_buf, sizeof (eta_buf), "%llud %02d:%02d:%02d", (unsigned long long) (secs / 86400), (int) (secs / 3600 % 24), (int) (secs / 60 % 60), (int) (secs % 60));
+    }
+
+    gmp_fprintf (stderr, "Status: %Zd/%Zd (%.2f%%), length %d, chain %s, %.3f Mc/s, ETA %s\n",
+                 status->ks_pos, status->ks_cnt,
+                 (mpz_sgn (status->ks_cnt)) ? mpz_get_d (status->ks_pos) * 100 / mpz_get_d (status->ks_cnt) : 0.0,
+                 seg->pw_len, chain, speed / 1e6, eta_buf);
+  }
+
+  if (status->metrics_file)
+  {
+    if (status_metrics_write (status, seg->pw_len, speed, eta, done) == -1) return (-1);
+  }
+
+  return 0;
+}
+
+int main (int argc, char *argv[])
+{
+  mpz_t skip;             mpz_init_set_si (skip,            0);
+  mpz_t limit;            mpz_init_set_si (limit,           0);
+  mpz_t tmp;              mpz_init_set_si (tmp,             0);
+
+  int     version       = 0;
+  int     usage         = 0;
+  int     keyspace      = 0;
+  int     pw_min        = PW_MIN;
+  int     pw_max        = PW_MAX;
+  int     elem_cnt_min  = ELEM_CNT_MIN;
+  int     elem_cnt_max  = ELEM_CNT_MAX;
+  int     wl_dist_len   = WL_DIST_LEN;
+  int     threads       = THREADS;
+  int     dedup_input   = DEDUP_INPUT;
+  int     weighted      = 0;
+  char   *require       = NULL;
+  char   *db_cache_file = NULL;
+  char   *output_shards = NULL;
+  char   *manifest_file = NULL;
+  u64     out_buf_size  = OUT_BUF_SIZE;
+  char   *output_file   = NULL;
+  char   *wordlist_file = NULL;
+  char   *restore_file  = NULL;
+  int     restore_timer = RESTORE_TIMER;
+  char   *split         = NULL;
+  int     split_bytes   = 0;
+  char   *benchmark     = NULL;
+  int     status_timer  = STATUS_TIMER;
+  char   *metrics_file  = NULL;
+  char   *output_format = NULL;
+  char   *rules_file    = NULL;
+  int     timings_on    = 0;
+  char   *timings_fmt   = NULL;
+  char   *nth           = NULL;
+  char   *rank          = NULL;
+  int     dedup_output  = 0;
+  char   *dedup_fp      = NULL;
+  u64     dedup_mem     = DEDUP_MEM;
+  int     dedup_mem_set = 0;
+
+  #define IDX_VERSION       'V'
+  #define IDX_USAGE         'h'
   #define IDX_PW_MIN        0x1000
   #define IDX_PW_MAX        0x2000
   #define IDX_ELEM_CNT_MIN  0x3000
   #define IDX_ELEM_CNT_MAX  0x4000
   #define IDX_KEYSPACE      0x5000
   #define IDX_WL_DIST_LEN   0x6000
+  #define IDX_THREADS       0x7000
+  #define IDX_OUT_BUF_SIZE  0x8000
+  #define IDX_DEDUP_INPUT   0x9000
+  #define IDX_RESTORE_FILE  0xa000
+  #define IDX_RESTORE_TIMER 0xb000
+  #define IDX_SPLIT         0xc000
+  #define IDX_SPLIT_BYTES   0xd000
+  #define IDX_BENCHMARK     0xe000
+  #define IDX_STATUS_TIMER  0xf000
+  #define IDX_METRICS_FILE  0x10000
+  #define IDX_OUTPUT_FORMAT 0x11000
+  #define IDX_RULES         0x12000
+  #define IDX_WEIGHTED      0x13000
+  #define IDX_REQUIRE       0x14000
+  #define IDX_DB_CACHE      0x15000
+  #define IDX_OUTPUT_SHARDS 0x16000
+  #define IDX_MANIFEST      0x17000
+  #define IDX_TIMINGS       0x18000
+  #define IDX_NTH           0x19000
+  #define IDX_RANK          0x1a000
+  #define IDX_DEDUP_OUTPUT  0x1b000
+  #define IDX_DEDUP_MEM     0x1c000
   #define IDX_SKIP          's'
   #define IDX_LIMIT         'l'
   #define IDX_OUTPUT_FILE   'o'
+  #define IDX_WORDLIST_FILE 'w'
 
   struct option long_options[] =
   {
@@ -524,9 +2776,32 @@ int main (int argc, char *argv[])
     {"elem-cnt-min",  required_argument, 0, IDX_ELEM_CNT_MIN},
     {"elem-cnt-max",  required_argument, 0, IDX_ELEM_CNT_MAX},
     {"wl-dist-len",   no_argument,       0, IDX_WL_DIST_LEN},
+    {"threads",       required_argument, 0, IDX_THREADS},
+    {"out-buf-size",  required_argument, 0, IDX_OUT_BUF_SIZE},
+    {"dedup-input",   no_argument,       0, IDX_DEDUP_INPUT},
     {"skip",          required_argument, 0, IDX_SKIP},
     {"limit",         required_argument, 0, IDX_LIMIT},
     {"output-file",   required_argument, 0, IDX_OUTPUT_FILE},
+    {"wordlist",      required_argument, 0, IDX_WORDLIST_FILE},
+    {"restore-file",  required_argument, 0, IDX_RESTORE_FILE},
+    {"restore-timer", required_argument, 0, IDX_RESTORE_TIMER},
+    {"split",         required_argument, 0, IDX_SPLIT},
+    {"split-bytes",   no_argument,       0, IDX_SPLIT_BYTES},
+    {"benchmark",     required_argument, 0, IDX_BENCHMARK},
+    {"status-timer",  required_argument, 0, IDX_STATUS_TIMER},
+    {"metrics-file",  required_argument, 0, IDX_METRICS_FILE},
+    {"output-format", required_argument, 0, IDX_OUTPUT_FORMAT},
+    {"rules",         required_argument, 0, IDX_RULES},
+    {"weighted",      no_argument,       0, IDX_WEIGHTED},
+    {"require",       required_argument, 0, IDX_REQUIRE},
+    {"db-cache",      required_argument, 0, IDX_DB_CACHE},
+    {"output-shards", required_argument, 0, IDX_OUTPUT_SHARDS},
+    {"manifest",      required_argument, 0, IDX_MANIFEST},
+    {"timings",       optional_argument, 0, IDX_TIMINGS},
+    {"nth",           required_argument, 0, IDX_NTH},
+    {"rank",          required_argument, 0, IDX_RANK},
+    {"dedup-output",  optional_argument, 0, IDX_DEDUP_OUTPUT},
+    {"dedup-mem",     required_argument, 0, IDX_DEDUP_MEM},
     {0, 0, 0, 0}
   };
 
@@ -534,7 +2809,7 @@ int main (int argc, char *argv[])
 
   int c;
 
-  while ((c = getopt_long (argc, argv, "Vhs:l:o:", long_options, &option_index)) != -1)
+  while ((c = getopt_long (argc, argv, "Vhs:l:o:w:", long_options, &option_index)) != -1)
   {
     switch (c)
     {
@@ -546,14 +2821,46 @@ int main (int argc, char *argv[])
       case IDX_ELEM_CNT_MIN:  elem_cnt_min    = atoi (optarg);  break;
       case IDX_ELEM_CNT_MAX:  elem_cnt_max    = atoi (optarg);  break;
       case IDX_WL_DIST_LEN:   wl_dist_len     = 1;              break;
+      case IDX_THREADS:       threads         = atoi (optarg);  break;
+      case IDX_OUT_BUF_SIZE:  out_buf_size    = strtoull (optarg, NULL, 0); break;
+      case IDX_DEDUP_INPUT:   dedup_input     = 1;              break;
       case IDX_SKIP:          mpz_set_str (skip,  optarg, 0);   break;
       case IDX_LIMIT:         mpz_set_str (limit, optarg, 0);   break;
       case IDX_OUTPUT_FILE:   output_file     = optarg;         break;
+      case IDX_WORDLIST_FILE: wordlist_file   = optarg;         break;
+      case IDX_RESTORE_FILE:  restore_file    = optarg;         break;
+      case IDX_RESTORE_TIMER: restore_timer   = atoi (optarg);  break;
+      case IDX_SPLIT:         split           = optarg;         break;
+      case IDX_SPLIT_BYTES:   split_bytes     = 1;              break;
+      case IDX_BENCHMARK:     benchmark       = optarg;         break;
+      case IDX_STATUS_TIMER:  status_timer    = atoi (optarg);  break;
+      case IDX_METRICS_FILE:  metrics_file    = optarg;         break;
+      case IDX_OUTPUT_FORMAT: output_format   = optarg;         break;
+      case IDX_RULES:         rules_file      = optarg;         break;
+      case IDX_WEIGHTED:      weighted        = 1;              break;
+      case IDX_REQUIRE:       require         = optarg;         break;
+      case IDX_DB_CACHE:      db_cache_file   = optarg;         break;
+      case IDX_OUTPUT_SHARDS: output_shards   = optarg;         break;
+      case IDX_MANIFEST:      manifest_file   = optarg;         break;
+      case IDX_TIMINGS:       timings_on      = 1;
+                              timings_fmt     = optarg;         break;
+      case IDX_NTH:           nth             = optarg;         break;
+      case IDX_RANK:          rank            = optarg;         break;
+      case IDX_DEDUP_OUTPUT:  dedup_output    = 1;
+                              dedup_fp        = optarg;         break;
+      case IDX_DEDUP_MEM:     dedup_mem       = strtoull (optarg, NULL, 0);
+                              dedup_mem_set   = 1;              break;
 
       default: return (-1);
     }
   }
 
+  timings_t timings;
+
+  memset (&timings, 0, sizeof (timings_t));
+
+  clock_gettime (CLOCK_MONOTONIC, &timings.time_last);
+
   if (usage)
   {
     usage_big_print (argv[0]);
@@ -603,6 +2910,235 @@ int main (int argc, char *argv[])
     return (-1);
   }
 
+  if ((threads <= 0) || (threads > THREADS_MAX))
+  {
+    fprintf (stderr, "Value of --threads (%d) must be between %d and %d\n", threads, 1, THREADS_MAX);
+
+    return (-1);
+  }
+
+  if (restore_timer <= 0)
+  {
+    fprintf (stderr, "Value of --restore-timer (%d) must be greater than %d\n", restore_timer, 0);
+
+    return (-1);
+  }
+
+  int out_format = OUT_FORMAT_TEXT;
+
+  if (output_format)
+  {
+    if      (strcmp (output_format, "text")      == 0) out_format = OUT_FORMAT_TEXT;
+    else if (strcmp (output_format, "lenprefix") == 0) out_format = OUT_FORMAT_LENPREFIX;
+    else if (strcmp (output_format, "fixed16")   == 0) out_format = OUT_FORMAT_FIXED16;
+    else if (strcmp (output_format, "fixed32")   == 0) out_format = OUT_FORMAT_FIXED32;
+    else
+    {
+      fprintf (stderr, "Value of --output-format (%s) must be text, lenprefix, fixed16 or fixed32\n", output_format);
+
+      return (-1);
+    }
+
+    if (pw_max > rec_len_get (out_format, OUT_LEN_MAX))
+    {
+      fprintf (stderr, "Value of --pw-max (%d) must be smaller or equal than %d for --output-format=%s\n", pw_max, rec_len_get (out_format, OUT_LEN_MAX), output_format);
+
+      return (-1);
+    }
+  }
+
+  int req_mask = 0;
+
+  if (require)
+  {
+    char *list = strdup (require);
+
+    for (char *name = strtok (list, ","); name; name = strtok (NULL, ","))
+    {
+      if      (strcmp (name, "lower")   == 0) req_mask |= CLASS_LOWER;
+      else if (strcmp (name, "upper")   == 0) req_mask |= CLASS_UPPER;
+      else if (strcmp (name, "digit")   == 0) req_mask |= CLASS_DIGIT;
+      else if (strcmp (name, "special") == 0) req_mask |= CLASS_SPECIAL;
+      else
+      {
+        fprintf (stderr, "Value of --require (%s) must be a list of lower, upper, digit and special\n", require);
+
+        free (list);
+
+        return (-1);
+      }
+    }
+
+    free (list);
+  }
+
+  if (rules_file && (out_format != OUT_FORMAT_TEXT) && (out_format != OUT_FORMAT_LENPREFIX))
+  {
+    fprintf (stderr, "Option --rules can only be used with --output-format=text or lenprefix\n");
+
+    return (-1);
+  }
+
+  if (status_timer < 0)
+  {
+    fprintf (stderr, "Value of --status-timer (%d) must be greater or equal than %d\n", status_timer, 0);
+
+    return (-1);
+  }
+
+  int split_idx = 0;
+  int split_cnt = 0;
+
+  if (split)
+  {
+    if ((sscanf (split, "%d/%d", &split_idx, &split_cnt) != 2) || (split_cnt <= 0) || (split_idx <= 0) || (split_idx > split_cnt))
+    {
+      fprintf (stderr, "Value of --split (%s) must be K/N with K between %d and N\n", split, 1);
+
+      return (-1);
+    }
+
+    if (mpz_cmp_si (skip, 0) || mpz_cmp_si (limit, 0))
+    {
+      fprintf (stderr, "Option --split can not be used together with --skip or --limit\n");
+
+      return (-1);
+    }
+  }
+
+  if (nth)
+  {
+    if (mpz_cmp_si (skip, 0) || mpz_cmp_si (limit, 0) || split)
+    {
+      fprintf (stderr, "Option --nth can not be used together with --skip, --limit or --split\n");
+
+      return (-1);
+    }
+
+    if ((mpz_set_str (skip, nth, 0) == -1) || (mpz_sgn (skip) < 0))
+    {
+      fprintf (stderr, "Value of --nth (%s) must be a position\n", nth);
+
+      return (-1);
+    }
+
+    // the candidate is the only one of the range starting at it
+
+    mpz_set_si (limit, 1);
+  }
+
+  if (rank)
+  {
+    if (mpz_cmp_si (skip, 0) || mpz_cmp_si (limit, 0) || split || rules_file)
+    {
+      fprintf (stderr, "Option --rank can not be used together with --skip, --limit, --nth, --split or --rules\n");
+
+      return (-1);
+    }
+  }
+
+  int benchmark_time = 0;
+
+  if (benchmark)
+  {
+    char *end = NULL;
+
+    benchmark_time = strtol (benchmark, &end, 10);
+
+    if ((*benchmark == 0) || (*end != 0) || (benchmark_time < 0))
+    {
+      fprintf (stderr, "Value of --benchmark (%s) must be greater or equal than %d\n", benchmark, 0);
+
+      return (-1);
+    }
+
+    if (output_file || restore_file)
+    {
+      fprintf (stderr, "Option --benchmark can not be used together with --output-file or --restore-file\n");
+
+      return (-1);
+    }
+  }
+
+  if (output_shards && (output_file || benchmark))
+  {
+    fprintf (stderr, "Option --output-shards can not be used together with --output-file or --benchmark\n");
+
+    return (-1);
+  }
+
+  if (dedup_output && (rules_file || restore_file))
+  {
+    // the filters are not saved, a resumed run would write the earlier candidates again
+
+    fprintf (stderr, "Option --dedup-output can not be used together with --rules or --restore-file\n");
+
+    return (-1);
+  }
+
+  if (dedup_mem_set && (dedup_output == 0))
+  {
+    fprintf (stderr, "Option --dedup-mem requires --dedup-output\n");
+
+    return (-1);
+  }
+
+  if (manifest_file && (output_shards == NULL))
+  {
+    fprintf (stderr, "Option --manifest requires --output-shards\n");
+
+    return (-1);
+  }
+
+  if (db_cache_file && (wordlist_file == NULL))
+  {
+    fprintf (stderr, "Option --db-cache requires --wordlist\n");
+
+    return (-1);
+  }
+
+  if (timings_fmt)
+  {
+    if (strcmp (timings_fmt, "json"))
+    {
+      fprintf (stderr, "Value of --timings (%s) must be json or left out\n", timings_fmt);
+
+      return (-1);
+    }
+
+    timings.json = 1;
+  }
+
+  double dedup_fp_rate = DEDUP_FP_RATE;
+
+  if (dedup_fp)
+  {
+    char *end = NULL;
+
+    dedup_fp_rate = strtod (dedup_fp, &end);
+
+    if ((*dedup_fp == 0) || (*end != 0) || (dedup_fp_rate <= 0) || (dedup_fp_rate >= 1))
+    {
+      fprintf (stderr, "Value of --dedup-output (%s) must be a rate between 0 and 1 or left out\n", dedup_fp);
+
+      return (-1);
+    }
+  }
+
+  if (dedup_mem < DEDUP_MEM_MIN)
+  {
+    fprintf (stderr, "Value of --dedup-mem (%llu) must be greater or equal than %d\n", (unsigned long long) dedup_mem, DEDUP_MEM_MIN);
+
+    return (-1);
+  }
+
+  if (out_buf_size < OUT_BUF_SIZE_MIN)
+  {
+    fprintf (stderr, "Value of --out-buf-size (%llu) must be greater or equal than %d\n", (unsigned long long) out_buf_size, OUT_BUF_SIZE_MIN);
+
+    return (-1);
+  }
+
   if (pw_min > pw_max)
   {
     fprintf (stderr, "Value of --pw-min (%d) must be smaller or equal than value of --pw-max (%d)\n", pw_min, pw_max);
@@ -624,9 +3160,16 @@ int main (int argc, char *argv[])
     return (-1);
   }
 
-  if (pw_max > IN_LEN_MAX)
+  if (pw_max > OUT_LEN_MAX)
+  {
+    fprintf (stderr, "Value of --pw-max (%d) must be smaller or equal than %d\n", pw_max, OUT_LEN_MAX);
+
+    return (-1);
+  }
+
+  if (elem_cnt_max > CHAIN_ELEMS_MAX)
   {
-    fprintf (stderr, "Value of --pw-max (%d) must be smaller or equal than %d\n", pw_max, IN_LEN_MAX);
+    fprintf (stderr, "Value of --elem-cnt-max (%d) must be smaller or equal than %d\n", elem_cnt_max, CHAIN_ELEMS_MAX);
 
     return (-1);
   }
@@ -646,18 +3189,60 @@ int main (int argc, char *argv[])
   setmode (fileno (stdout), O_BINARY);
   #endif
 
+  /**
+   * load rules
+   */
+
+  rules_t *rules = NULL;
+
+  if (rules_file)
+  {
+    rules = (rules_t *) malloc (sizeof (rules_t));
+
+    if (rules_load (rules_file, rules) == -1) return (-1);
+
+    // the output buffer has to take all rule results of one candidate
+
+    out_buf_size = MAX (out_buf_size, rules->rec_max_all);
+  }
+
   /**
    * alloc some space
    */
 
-  db_entry_t *db_entries   = (db_entry_t *) calloc (IN_LEN_MAX + 1, sizeof (db_entry_t));
-  pw_order_t *pw_orders    = (pw_order_t *) calloc (IN_LEN_MAX + 1, sizeof (pw_order_t));
-  u64        *wordlen_dist = (u64 *)        calloc (IN_LEN_MAX + 1, sizeof (u64));
+  engine_t *engine = (engine_t *) malloc (sizeof (engine_t));
+
+  engine_init (engine, pw_min, pw_max, elem_cnt_min, elem_cnt_max, wl_dist_len, weighted, req_mask);
+
+  if (timings_on)
+  {
+    engine->phase_cb  = timings_mark;
+    engine->phase_ctx = &timings;
+  }
+
+  db_entry_t *db_entries = engine->db_entries;
 
   out_t *out = (out_t *) malloc (sizeof (out_t));
 
-  out->fp  = stdout;
-  out->len = 0;
+  out->fp       = stdout;
+  out->size     = out_buf_size;
+  out->len      = 0;
+  out->format   = out_format;
+  out->rules    = rules;
+  out->units    = 0;
+
+  out->writers_buf = NULL;
+  out->writers_cnt = 0;
+  out->shard_files = NULL;
+  out->shard_last  = -1;
+
+  out->manifest_fp    = NULL;
+  out->manifest_shard = -1;
+
+  out->dedup = NULL;
+
+  mpz_init (out->manifest_beg);
+  mpz_init (out->manifest_pos);
 
   /**
    * files
@@ -675,11 +3260,130 @@ int main (int argc, char *argv[])
     }
   }
 
+  int shards_cnt = 1;
+
+  char *shards_buf = NULL;
+
+  if (output_shards)
+  {
+    shards_buf = strdup (output_shards);
+
+    out->shard_files = (char **) calloc (strlen (output_shards) + 1, sizeof (char *));
+
+    shards_cnt = 0;
+
+    for (char *name = strtok (shards_buf, ","); name; name = strtok (NULL, ","))
+    {
+      out->shard_files[shards_cnt++] = name;
+    }
+
+    if (shards_cnt == 0)
+    {
+      fprintf (stderr, "Value of --output-shards (%s) must be a list of files\n", output_shards);
+
+      return (-1);
+    }
+  }
+
+  // one spare per shard, a flush only waits once every shard holds one
+
+  out->spares_cnt     = shards_cnt;
+  out->spares_buf     = (char **)    calloc (out->spares_cnt, sizeof (char *));
+  out->spares_tickets = (ticket_t *) calloc (out->spares_cnt, sizeof (ticket_t));
+
+  if ((out->spares_buf == NULL) || (out->spares_tickets == NULL))
+  {
+    fprintf (stderr, "Out of memory trying to allocate output buffers!\n");
+
+    return (-1);
+  }
+
+  out->buf = (char *) malloc (out_buf_size + OUT_SLACK);
+
+  for (int spares_idx = 0; spares_idx < out->spares_cnt; spares_idx++)
+  {
+    out->spares_buf[spares_idx] = (char *) malloc (out_buf_size + OUT_SLACK);
+
+    if ((out->buf == NULL) || (out->spares_buf[spares_idx] == NULL))
+    {
+      fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n",
+               (size_t) out_buf_size + OUT_SLACK);
+
+      return (-1);
+    }
+  }
+
+  if (benchmark)
+  {
+    out->fp = NULL;
+  }
+  else
+  {
+    // one queue entry per buffer that can be with the writers, the job buffers are swapped for
+    // spares. Opening a FIFO waits for its reader
+
+    out->writers_buf = (writer_t *) calloc (shards_cnt, sizeof (writer_t));
+    out->writers_cnt = shards_cnt;
+
+    for (int shards_idx = 0; shards_idx < shards_cnt; shards_idx++)
+    {
+      FILE *fp = out->fp;
+
+      if (output_shards)
+      {
+        fp = fopen (out->shard_files[shards_idx], "ab");
+
+        if (fp == NULL)
+        {
+          fprintf (stderr, "%s: %s\n", out->shard_files[shards_idx], strerror (errno));
+
+          return (-1);
+        }
+      }
+
+      writer_init (&out->writers_buf[shards_idx], fp, out->spares_cnt + 1, out_buf_size);
+    }
+  }
+
+  if (manifest_file)
+  {
+    out->manifest_fp = fopen (manifest_file, "ab");
+
+    if (out->manifest_fp == NULL)
+    {
+      fprintf (stderr, "%s: %s\n", manifest_file, strerror (errno));
+
+      return (-1);
+    }
+  }
+
   /**
-   * load elems from stdin
+   * load elems from the cache, the wordlist or stdin
    */
 
-  while (!feof (stdin))
+  db_cache_t db_cache;
+
+  char *db_cache_buf = NULL;
+  u64   db_cache_len = 0;
+
+  int db_cache_hit = 0;
+
+  if (db_cache_file)
+  {
+    if (db_cache_key (wordlist_file, dedup_input | (weighted << 1) | (req_mask << 2), &db_cache) == -1) return (-1);
+
+    db_cache_hit = db_cache_load (db_cache_file, &db_cache, engine, &db_cache_buf, &db_cache_len);
+  }
+
+  if (db_cache_hit)
+  {
+    // deduplicated and sorted already
+  }
+  else if (wordlist_file)
+  {
+    if (wl_load (wordlist_file, db_entries, threads, weighted) == -1) return (-1);
+  }
+  else while (!feof (stdin))
   {
     char buf[BUFSIZ];
 
@@ -687,174 +3391,261 @@ int main (int argc, char *argv[])
 
     if (input_buf == NULL) continue;
 
-    const int input_len = in_superchop (input_buf);
+    u64 input_len = in_superchop (input_buf);
+
+    const u64 weight = (weighted) ? wl_line_weight (input_buf, &input_len) : 0;
 
     if (input_len < IN_LEN_MIN) continue;
     if (input_len > IN_LEN_MAX) continue;
 
     db_entry_t *db_entry = &db_entries[input_len];
 
-    check_realloc_elems (db_entry);
+    check_realloc_elems (db_entry, weighted);
 
     elem_t *elem_buf = &db_entry->elems_buf[db_entry->elems_cnt];
 
     memcpy (elem_buf->buf, input_buf, input_len);
 
+    if (weighted) db_entry->weights_buf[db_entry->elems_cnt] = weight;
+
     db_entry->elems_cnt++;
   }
 
+  if (timings_on) timings_mark (&timings, "load");
+
   /**
-   * init chains
+   * remove duplicate elems
    */
 
-  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  u64 elems_raw_cnts[IN_LEN_MAX + 1][CLASS_MASKS] = {{ 0 }};
+
+  u64 dupes_cnt = 0;
+
+  if (db_cache_hit)
+  {
+    memcpy (elems_raw_cnts, db_cache.elems_raw_cnts, sizeof (elems_raw_cnts));
+
+    dupes_cnt = db_cache.dupes_cnt;
+  }
+  else if (dedup_input)
   {
-    db_entry_t *db_entry = &db_entries[pw_len];
+    dupes_cnt = engine_dedup (engine, elems_raw_cnts);
+  }
 
-    const int pw_len1 = pw_len - 1;
+  // the fingerprint is taken before the elements are sorted, the cache keeps it
 
-    const int chains_cnt = 1 << pw_len1;
+  u64 fingerprint = 0;
 
-    chain_t chain_buf_new;
+  if (db_cache_hit)
+  {
+    fingerprint = db_cache.fingerprint;
+  }
+  else if (restore_file || db_cache_file)
+  {
+    fingerprint = restore_fingerprint (db_entries);
+  }
 
-    for (int chains_idx = 0; chains_idx < chains_cnt; chains_idx++)
-    {
-      chain_gen_with_idx (&chain_buf_new, pw_len1, chains_idx);
+  if (timings_on) timings_mark (&timings, "dedup");
 
-      // make sure all the elements really exist
+  /**
+   * restore point of this wordlist and options
+   */
+
+  restore_t restore;
+
+  mpz_init (restore.skip);
+  mpz_init (restore.limit);
+  mpz_init (restore.pos);
 
-      int valid1 = chain_valid_with_db (&chain_buf_new, db_entries);
+  if (restore_file)
+  {
+    restore.fingerprint  = fingerprint;
+    restore.pw_min       = pw_min;
+    restore.pw_max       = pw_max;
+    restore.elem_cnt_min = elem_cnt_min;
+    restore.elem_cnt_max = elem_cnt_max;
+    restore.wl_dist_len  = wl_dist_len;
+    restore.dedup_input  = dedup_input;
 
-      if (valid1 == 0) continue;
+    if (rules) restore.fingerprint ^= rules->fingerprint;
 
-      // boost by verify element count to be inside a specific range
+    if (req_mask) restore.fingerprint = (restore.fingerprint ^ req_mask) * 0x100000001b3ULL;
+  }
 
-      int valid2 = chain_valid_with_cnt_min (&chain_buf_new, elem_cnt_min);
+  /**
+   * Calculate keyspace stuff
+   */
 
-      if (valid2 == 0) continue;
+  engine_keyspace (engine);
 
-      int valid3 = chain_valid_with_cnt_max (&chain_buf_new, elem_cnt_max);
+  if (db_cache_file && (db_cache_hit == 0))
+  {
+    db_cache.fingerprint = fingerprint;
+    db_cache.dupes_cnt   = dupes_cnt;
 
-      if (valid3 == 0) continue;
+    memcpy (db_cache.elems_raw_cnts, elems_raw_cnts, sizeof (elems_raw_cnts));
 
-      // add chain to database
+    if (db_cache_write (db_cache_file, &db_cache, engine) == -1) return (-1);
 
-      check_realloc_chains (db_entry);
+    if (timings_on) timings_mark (&timings, "cache write");
+  }
 
-      chain_t *chain_buf = &db_entry->chains_buf[db_entry->chains_cnt];
+  mpz_srcptr total_ks_cnt = engine->total_ks_cnt;
 
-      memcpy (chain_buf, &chain_buf_new, sizeof (chain_t));
+  if (dedup_input)
+  {
+    // same calculation with the element counts before deduplication
 
-      mpz_init_set_si (chain_buf->ks_cnt, 0);
-      mpz_init_set_si (chain_buf->ks_pos, 0);
+    keyspace_calc (elems_raw_cnts, req_mask, pw_min, pw_max, elem_cnt_min, elem_cnt_max, NULL, tmp);
 
-      db_entry->chains_cnt++;
-    }
+    mpz_sub (tmp, tmp, total_ks_cnt);
 
-    memset (db_entry->cur_chain_ks_poses, 0, ELEM_CNT_MAX * sizeof (u64));
+    gmp_fprintf (stderr, "Removed %llu duplicate words, keyspace reduced by %Zd to %Zd\n", (unsigned long long) dupes_cnt, tmp, total_ks_cnt);
   }
 
-  /**
-   * calculate password candidate output length distribution
-   */
+  // with --rules every candidate is followed by its rule results, from here on
+  // keyspace, --skip, --limit and positions count these
+
+  const u64 ks_mul = (rules) ? (u64) rules->rules_cnt : 1;
 
-  if (wl_dist_len)
+  mpz_t total_ks_out; mpz_init (total_ks_out);
+  mpz_t ks_end;       mpz_init (ks_end);
+
+  mpz_mul_ui (total_ks_out, total_ks_cnt, ks_mul);
+
+  mpz_set (ks_end, total_ks_out);
+
+  if (keyspace && (split_cnt == 0))
   {
-    for (int pw_len = IN_LEN_MIN; pw_len <= IN_LEN_MAX; pw_len++)
-    {
-      db_entry_t *db_entry = &db_entries[pw_len];
+    mpz_out_str (stdout, 10, total_ks_out);
 
-      wordlen_dist[pw_len] = db_entry->elems_cnt;
-    }
+    printf ("\n");
+
+    if (timings_on) timings_report (&timings, engine, 0);
+
+    return 0;
   }
-  else
+
+  /**
+   * init chains, output length distribution and global order
+   */
+
+  engine_chains (engine);
+
+  /**
+   * positions of a candidate
+   */
+
+  if (rank)
   {
-    for (int pw_len = IN_LEN_MIN; pw_len <= IN_LEN_MAX; pw_len++)
+    rank_t *ranks_buf;
+
+    const u64 ranks_cnt = engine_rank (engine, rank, strlen (rank), &ranks_buf);
+
+    for (u64 ranks_idx = 0; ranks_idx < ranks_cnt; ranks_idx++)
     {
-      if (pw_len < DEF_WORDLEN_DIST_CNT)
+      const rank_t *r = &ranks_buf[ranks_idx];
+
+      // position, length, chain of the length, element lengths, element indices
+
+      gmp_printf ("%Zd %d %llu ", r->ks_pos, r->pw_len, (unsigned long long) r->chain_pos);
+
+      for (int idx = 0; idx < r->chain_buf.cnt; idx++)
       {
-        wordlen_dist[pw_len] = DEF_WORDLEN_DIST[pw_len];
+        printf ((idx) ? "+%d" : "%d", r->chain_buf.buf[idx]);
       }
-      else
+
+      for (int idx = 0; idx < r->chain_buf.cnt; idx++)
       {
-        wordlen_dist[pw_len] = 1;
+        printf ((idx) ? ",%llu" : " %llu", (unsigned long long) r->elems_idxs[idx]);
       }
+
+      printf ("\n");
+    }
+
+    ranks_free (ranks_buf, ranks_cnt);
+
+    if (timings_on) timings_report (&timings, engine, 1);
+
+    if (ranks_cnt == 0)
+    {
+      fprintf (stderr, "%s: Not in the keyspace\n", rank);
+
+      return (-1);
     }
+
+    return 0;
   }
 
   /**
-   * Calculate keyspace stuff
+   * split the keyspace into equal shares by candidates or output bytes
    */
 
-  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+  if (split_cnt)
   {
-    db_entry_t *db_entry = &db_entries[pw_len];
-
-    int      chains_cnt = db_entry->chains_cnt;
-    chain_t *chains_buf = db_entry->chains_buf;
+    mpz_t bytes_max; mpz_init (bytes_max);
 
-    mpz_set_si (tmp, 0);
+    u64 rec_lens[OUT_LEN_MAX + 1] = { 0 };
 
-    for (int chains_idx = 0; chains_idx < chains_cnt; chains_idx++)
+    for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
     {
-      chain_t *chain_buf = &chains_buf[chains_idx];
+      rec_lens[pw_len] = (rules) ? rules->rec_max[pw_len] : (u64) rec_len_get (out_format, pw_len);
+    }
 
-      chain_ks (chain_buf, db_entries, chain_buf->ks_cnt);
+    for (int bound = 0; bound < 2; bound++)
+    {
+      mpz_ptr ks_pos = (bound == 0) ? skip : limit;
 
-      mpz_add (tmp, tmp, chain_buf->ks_cnt);
-    }
+      const int node = split_idx - 1 + bound;
 
-    mpz_add (total_ks_cnt, total_ks_cnt, tmp);
+      if (split_bytes)
+      {
+        mpz_set_si (bytes_max, 0);
 
-    if (mpz_cmp_si (skip, 0))
-    {
-      mpz_init_set (pw_ks_cnt[pw_len], tmp);
-    }
-  }
+        for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+        {
+          mpz_addmul_ui (bytes_max, engine->pw_ks_cnt[pw_len], rec_lens[pw_len]);
+        }
 
-  if (keyspace)
-  {
-    mpz_out_str (stdout, 10, total_ks_cnt);
+        mpz_mul_ui (bytes_max, bytes_max, node);
 
-    printf ("\n");
+        mpz_fdiv_q_ui (bytes_max, bytes_max, split_cnt);
 
-    return 0;
-  }
+        split_pos_by_bytes (ks_pos, bytes_max, engine->pw_orders, engine->order_cnt, engine->wordlen_dist, engine->pw_ks_cnt, rec_lens);
 
-  /**
-   * sort chains by ks
-   */
+        mpz_mul_ui (ks_pos, ks_pos, ks_mul);
+      }
+      else
+      {
+        mpz_mul_ui (ks_pos, total_ks_out, node);
 
-  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
-  {
-    db_entry_t *db_entry = &db_entries[pw_len];
+        mpz_fdiv_q_ui (ks_pos, ks_pos, split_cnt);
+      }
+    }
 
-    chain_t *chains_buf = db_entry->chains_buf;
+    mpz_sub (limit, limit, skip);
 
-    const int chains_cnt = db_entry->chains_cnt;
+    mpz_clear (bytes_max);
 
-    qsort (chains_buf, chains_cnt, sizeof (chain_t), sort_by_ks);
-  }
+    gmp_fprintf (stderr, "Split %d/%d: --skip=%Zd --limit=%Zd\n", split_idx, split_cnt, skip, limit);
 
-  /**
-   * sort global order by password length counts
-   */
+    if (timings_on) timings_mark (&timings, "split");
 
-  for (int pw_len = pw_min, order_pos = 0; pw_len <= pw_max; pw_len++, order_pos++)
-  {
-    db_entry_t *db_entry = &db_entries[pw_len];
+    if (keyspace)
+    {
+      mpz_out_str (stdout, 10, limit);
 
-    const u64 elems_cnt = db_entry->elems_cnt;
+      printf ("\n");
 
-    pw_order_t *pw_order = &pw_orders[order_pos];
+      if (timings_on) timings_report (&timings, engine, 1);
 
-    pw_order->len = pw_len;
-    pw_order->cnt = elems_cnt;
-  }
+      return 0;
+    }
 
-  const int order_cnt = pw_max + 1 - pw_min;
+    // an empty share, a limit of zero would mean no limit
 
-  qsort (pw_orders, order_cnt, sizeof (pw_order_t), sort_by_cnt);
+    if (mpz_cmp_si (limit, 0) == 0) return 0;
+  }
 
   /**
    * seek to some starting point
@@ -862,9 +3653,9 @@ int main (int argc, char *argv[])
 
   if (mpz_cmp_si (skip, 0))
   {
-    if (mpz_cmp (skip, total_ks_cnt) >= 0)
+    if (mpz_cmp (skip, total_ks_out) >= 0)
     {
-      fprintf (stderr, "Value of --skip must be smaller than total keyspace\n");
+      fprintf (stderr, "Value of %s must be smaller than total keyspace\n", (nth) ? "--nth" : "--skip");
 
       return (-1);
     }
@@ -872,7 +3663,7 @@ int main (int argc, char *argv[])
 
   if (mpz_cmp_si (limit, 0))
   {
-    if (mpz_cmp (limit, total_ks_cnt) > 0)
+    if (mpz_cmp (limit, total_ks_out) > 0)
     {
       fprintf (stderr, "Value of --limit cannot be larger than total keyspace\n");
 
@@ -881,274 +3672,408 @@ int main (int argc, char *argv[])
 
     mpz_add (tmp, skip, limit);
 
-    if (mpz_cmp (tmp, total_ks_cnt) > 0)
+    if (mpz_cmp (tmp, total_ks_out) > 0)
     {
       fprintf (stderr, "Value of --skip + --limit cannot be larger than total keyspace\n");
 
       return (-1);
     }
 
-    mpz_set (total_ks_cnt, tmp);
+    mpz_set (ks_end, tmp);
   }
 
-  /**
-   * skip to the first main loop that will output a password
-   */
-
-  if (mpz_cmp_si (skip, 0))
+  if (restore_file)
   {
-    mpz_t skip_left;  mpz_init_set (skip_left, skip);
-    mpz_t main_loops; mpz_init (main_loops);
+    mpz_set (restore.skip,  skip);
+    mpz_set (restore.limit, limit);
 
-    u64 outs_per_main_loop = 0;
+    restore_t saved;
 
-    for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
-    {
-      mpz_init_set_si (pw_ks_pos[pw_len], 0);
+    mpz_init (saved.skip);
+    mpz_init (saved.limit);
+    mpz_init (saved.pos);
 
-      outs_per_main_loop += wordlen_dist[pw_len];
-    }
+    const int rc = restore_read (restore_file, &saved);
 
-    // find pw_ks_pos[]
+    if (rc == -2) return (-1);
 
-    while (1)
+    if (rc == 0)
     {
-      mpz_fdiv_q_ui (main_loops, skip_left, outs_per_main_loop);
-
-      if (mpz_cmp_si (main_loops, 0) == 0)
+      if ((saved.fingerprint  != restore.fingerprint)
+       || (saved.pw_min       != restore.pw_min)
+       || (saved.pw_max       != restore.pw_max)
+       || (saved.elem_cnt_min != restore.elem_cnt_min)
+       || (saved.elem_cnt_max != restore.elem_cnt_max)
+       || (saved.wl_dist_len  != restore.wl_dist_len)
+       || (saved.dedup_input  != restore.dedup_input)
+       || (mpz_cmp (saved.skip,  restore.skip)  != 0)
+       || (mpz_cmp (saved.limit, restore.limit) != 0)
+       || (mpz_cmp (saved.pos,   skip)          <  0)
+       || (mpz_cmp (saved.pos,   ks_end)        >  0))
       {
-        break;
+        fprintf (stderr, "%s: Restore file does not match wordlist or options\n", restore_file);
+
+        return (-1);
       }
 
-      // increment the main loop "main_loops" times
+      gmp_fprintf (stderr, "Restored from %s at position %Zd\n", restore_file, saved.pos);
 
-      for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
-      {
-        if (mpz_cmp (pw_ks_pos[pw_len], pw_ks_cnt[pw_len]) < 0)
-        {
-          mpz_mul_ui (tmp, main_loops, wordlen_dist[pw_len]);
+      mpz_set (skip, saved.pos);
+    }
 
-          mpz_add (pw_ks_pos[pw_len], pw_ks_pos[pw_len], tmp);
+    mpz_clear (saved.skip);
+    mpz_clear (saved.limit);
+    mpz_clear (saved.pos);
 
-          mpz_sub (skip_left, skip_left, tmp);
+    signal (SIGINT,  restore_signal);
+    signal (SIGTERM, restore_signal);
+  }
 
-          if (mpz_cmp (pw_ks_pos[pw_len], pw_ks_cnt[pw_len]) > 0)
-          {
-            mpz_sub (tmp, pw_ks_pos[pw_len], pw_ks_cnt[pw_len]);
+  /**
+   * move the engine to the first password
+   */
 
-            mpz_add (skip_left, skip_left, tmp);
-          }
-        }
-      }
+  // with --rules the first and the last candidate can be cut, rule_end are the
+  // rules of the candidate at the engine end
 
-      outs_per_main_loop = 0;
+  int rule_beg = 0;
+  int rule_end = 0;
 
-      for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
-      {
-        if (mpz_cmp (pw_ks_pos[pw_len], pw_ks_cnt[pw_len]) < 0)
-        {
-          outs_per_main_loop += wordlen_dist[pw_len];
-        }
-      }
-    }
+  engine_end_set (engine, ks_end);
 
-    mpz_sub (total_ks_pos, skip, skip_left);
+  mpz_set (out->manifest_beg, skip);
+  mpz_set (out->manifest_pos, skip);
 
-    // set db_entries to pw_ks_pos[]
+  if (rules)
+  {
+    rule_beg = mpz_fdiv_q_ui (skip, skip, ks_mul);
+    rule_end = mpz_fdiv_q_ui (tmp, ks_end, ks_mul);
 
-    for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+    engine_end_set (engine, tmp);
+  }
+
+  if (mpz_cmp_si (skip, 0))
+  {
+    engine_seek (engine, skip);
+  }
+
+  if (rule_beg)
+  {
+    if (mpz_cmp (skip, engine->total_ks_end) == 0)
     {
-      db_entry_t *db_entry = &db_entries[pw_len];
+      mpz_add_ui (tmp, engine->total_ks_end, 1);
 
-      int      chains_cnt = db_entry->chains_cnt;
-      chain_t *chains_buf = db_entry->chains_buf;
+      engine_end_set (engine, tmp);
 
-      mpz_set (tmp, pw_ks_pos[pw_len]);
+      out_rules_cand (out, engine, rule_beg, rule_end);
 
-      for (int chains_idx = 0; chains_idx < chains_cnt; chains_idx++)
-      {
-        chain_t *chain_buf = &chains_buf[chains_idx];
+      rule_end = 0;
+    }
+    else
+    {
+      out_rules_cand (out, engine, rule_beg, ks_mul);
+    }
 
-        if (mpz_cmp (tmp, chain_buf->ks_cnt) < 0)
-        {
-          mpz_set (chain_buf->ks_pos, tmp);
+    // the threads write directly, this has to go first
+
+    out_flush (out);
+  }
 
-          set_chain_ks_poses (chain_buf, db_entries, tmp, db_entry->cur_chain_ks_poses);
+  if (timings_on) timings_mark (&timings, "seek");
 
-          break;
-        }
+  /**
+   * output dedup, sized for the candidates from here to the end
+   */
 
-        mpz_sub (tmp, tmp, chain_buf->ks_cnt);
+  if (dedup_output)
+  {
+    out->dedup = (dedup_t *) malloc (sizeof (dedup_t));
 
-        db_entry->chains_pos++;
-      }
-    }
+    double cands[OUT_LEN_MAX + 1];
 
-    // clean up
+    split_len_range (cands, engine, skip, ks_end);
 
-    for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
+    dedup_init (out->dedup, pw_min, pw_max, cands, dedup_fp_rate, dedup_mem);
+
+    if (out->dedup->fp_rate > dedup_fp_rate * DEDUP_FP_SLACK)
     {
-      mpz_clear (pw_ks_cnt[pw_len]);
-      mpz_clear (pw_ks_pos[pw_len]);
+      fprintf (stderr, "Value of --dedup-mem (%llu) is too small, the false positive rate would be about %g instead of %g\n", (unsigned long long) dedup_mem, out->dedup->fp_rate, dedup_fp_rate);
+
+      return (-1);
     }
+  }
+
+  /**
+   * start generator threads
+   */
 
-    mpz_clear (skip_left);
-    mpz_clear (main_loops);
+  pool_t *pool = NULL;
+
+  if (threads > 1)
+  {
+    pool = (pool_t *) malloc (sizeof (pool_t));
+
+    pool_init (pool, threads, db_entries, out->format, rules, out->size);
   }
 
   /**
    * loop
    */
 
-  while (mpz_cmp (total_ks_pos, total_ks_cnt) < 0)
+  bench_t *bench = NULL;
+
+  if (benchmark)
   {
-    for (int order_pos = 0; order_pos < order_cnt; order_pos++)
+    bench = (bench_t *) calloc (1, sizeof (bench_t));
+
+    bench->time_max = benchmark_time;
+    bench->cnt_mul  = ks_mul;
+
+    for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
     {
-      pw_order_t *pw_order = &pw_orders[order_pos];
+      bench->rec_lens[pw_len] = (rules) ? rules->rec_max[pw_len] : (u64) rec_len_get (out_format, pw_len);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &bench->time_beg);
+
+    bench->time_last = bench->time_beg;
+  }
+
+  status_t status;
+
+  status.metrics_file = metrics_file;
+  status.print_timer  = (status_timer > 0);
+  status.timer        = (status_timer > 0) ? status_timer : (metrics_file) ? METRICS_TIMER : 0;
+  status.next         = time (NULL) + status.timer;
+
+  status.ks_mul       = ks_mul;
+
+  clock_gettime (CLOCK_MONOTONIC, &status.time_beg);
+
+  mpz_init_set (status.ks_cnt, total_ks_out);
+  mpz_init_set (status.ks_end, ks_end);
+  mpz_init (status.ks_pos);
+  mpz_init (status.pos_beg);
+  mpz_init (status.tmp);
+
+  ks_pos_get (status.pos_beg, engine, ks_mul, ks_end);
+
+  #ifdef SIGUSR1
+  signal (SIGUSR1, status_signal);
+  #endif
+
+  time_t restore_next = time (NULL) + restore_timer;
 
-      const int pw_len = pw_order->len;
+  seg_t seg;
 
-      char pw_buf[BUFSIZ];
+  memset (&seg, 0, sizeof (seg_t));
 
-      pw_buf[pw_len] = '\n';
+  while ((restore_stop == 0) && engine_next (engine, &seg, (u64) -1))
+  {
+    if (pool)
+    {
+      pool_push (pool, out, &seg.chain_buf, seg.pw_len, seg.cur_chain_ks_poses, seg.iter_cnt);
+    }
+    else
+    {
+      char pw_buf[OUT_SLACK];
 
-      db_entry_t *db_entry = &db_entries[pw_len];
+      rec_tpl_init ((rules) ? OUT_FORMAT_TEXT : out->format, &seg, db_entries, pw_buf);
 
-      const u64 outs_cnt = wordlen_dist[pw_len];
+      out_emit (out, &seg.chain_buf, db_entries, seg.cur_chain_ks_poses, pw_buf, seg.pw_len, seg.iter_cnt);
+    }
 
-      u64 outs_pos = 0;
+    // a filter can go once the last candidates of its length went through it
 
-      while (outs_pos < outs_cnt)
+    if (out->dedup && (db_entries[seg.pw_len].chains_pos == db_entries[seg.pw_len].chains_cnt))
+    {
+      if (pool)
+      {
+        pool->jobs_buf[pool->jobs_fill].lens_done |= 1ULL << (seg.pw_len - 1);
+      }
+      else
       {
-        const int chains_cnt = db_entry->chains_cnt;
-        const int chains_pos = db_entry->chains_pos;
+        dedup_release (out->dedup, seg.pw_len);
+      }
+    }
 
-        if (chains_pos == chains_cnt) break;
+    if (bench)
+    {
+      bench_add (bench, &seg);
+
+      if ((bench->time_max > 0) && (time_elapsed (&bench->time_beg) >= bench->time_max)) break;
+    }
 
-        chain_t *chains_buf = db_entry->chains_buf;
+    if (status_request || (status.timer && (time (NULL) >= status.next)))
+    {
+      if (status_update (&status, engine, &seg, status_request || status.print_timer, 0) == -1) return (-1);
 
-        chain_t *chain_buf = &chains_buf[chains_pos];
+      status_request = 0;
 
-        mpz_sub (total_ks_left, total_ks_cnt, total_ks_pos);
+      status.next = time (NULL) + status.timer;
+    }
 
-        mpz_sub (iter_max, chain_buf->ks_cnt, chain_buf->ks_pos);
+    if (restore_file && (time (NULL) >= restore_next))
+    {
+      // everything before total_ks_pos has to be written before it is saved
 
-        if (mpz_cmp (total_ks_left, iter_max) < 0)
-        {
-          mpz_set (iter_max, total_ks_left);
-        }
+      if (pool) pool_drain (pool, out);
 
-        const u64 outs_left = outs_cnt - outs_pos;
+      out_sync (out);
 
-        mpz_set_ui (tmp, outs_left);
+      ks_pos_get (restore.pos, engine, ks_mul, ks_end);
 
-        if (mpz_cmp (tmp, iter_max) < 0)
-        {
-          mpz_set (iter_max, tmp);
-        }
+      if (restore_write (restore_file, &restore) == -1) return (-1);
 
-        const u64 iter_max_u64 = mpz_get_ui (iter_max);
+      restore_next = time (NULL) + restore_timer;
+    }
+  }
 
-        mpz_add (tmp, total_ks_pos, iter_max);
+  if (pool)
+  {
+    pool_finish (pool, out);
 
-        if (mpz_cmp (tmp, skip) > 0)
-        {
-          u64 iter_pos_u64 = 0;
+    free (pool);
+  }
 
-          if (mpz_cmp (total_ks_pos, skip) < 0)
-          {
-            mpz_sub (tmp, skip, total_ks_pos);
+  engine_pos_get (engine, tmp);
 
-            iter_pos_u64 = mpz_get_ui (tmp);
+  if (rule_end && (restore_stop == 0) && (mpz_cmp (tmp, engine->total_ks_end) == 0))
+  {
+    mpz_add_ui (tmp, engine->total_ks_end, 1);
 
-            mpz_add (tmp, chain_buf->ks_pos, tmp);
+    engine_end_set (engine, tmp);
 
-            set_chain_ks_poses (chain_buf, db_entries, tmp, db_entry->cur_chain_ks_poses);
-          }
+    out_rules_cand (out, engine, 0, rule_end);
+  }
 
-          u64 *cur_chain_ks_poses = db_entry->cur_chain_ks_poses;
+  out_flush (out);
 
-          chain_set_pwbuf_init (chain_buf, db_entries, cur_chain_ks_poses, pw_buf);
+  if (metrics_file)
+  {
+    engine_pos_get (engine, tmp);
 
-          while (iter_pos_u64 < iter_max_u64)
-          {
-            out_push (out, pw_buf, pw_len + 1);
+    const int done = (mpz_cmp (tmp, engine->total_ks_end) >= 0);
 
-            chain_set_pwbuf_increment (chain_buf, db_entries, cur_chain_ks_poses, pw_buf);
+    if (status_update (&status, engine, &seg, 0, done) == -1) return (-1);
+  }
 
-            iter_pos_u64++;
-          }
-        }
-        else
-        {
-          mpz_add (tmp, chain_buf->ks_pos, iter_max);
+  mpz_clear (status.ks_cnt);
+  mpz_clear (status.ks_end);
+  mpz_clear (status.ks_pos);
+  mpz_clear (status.pos_beg);
+  mpz_clear (status.tmp);
 
-          set_chain_ks_poses (chain_buf, db_entries, tmp, db_entry->cur_chain_ks_poses);
-        }
+  if (bench)
+  {
+    bench_report (bench, time_elapsed (&bench->time_beg));
 
-        outs_pos += iter_max_u64;
+    free (bench);
+  }
 
-        mpz_add (total_ks_pos, total_ks_pos, iter_max);
+  if (out->dedup)
+  {
+    fprintf (stderr, "Suppressed %llu duplicate candidates at a false positive rate of at most about %g\n", (unsigned long long) out->dedup->dups_cnt, out->dedup->fp_rate);
 
-        mpz_add (chain_buf->ks_pos, chain_buf->ks_pos, iter_max);
+    dedup_free (out->dedup);
 
-        if (mpz_cmp (chain_buf->ks_pos, chain_buf->ks_cnt) == 0)
-        {
-          db_entry->chains_pos++;
+    free (out->dedup);
+  }
 
-          // db_entry->cur_chain_ks_poses[] should of cycled to all zeros, but just in case?
+  if (restore_file)
+  {
+    if (restore_stop)
+    {
+      out_sync (out);
 
-          memset (db_entry->cur_chain_ks_poses, 0, ELEM_CNT_MAX * sizeof (u64));
-        }
+      ks_pos_get (restore.pos, engine, ks_mul, ks_end);
 
-        if (mpz_cmp (total_ks_pos, total_ks_cnt) == 0) break;
-      }
+      if (restore_write (restore_file, &restore) == -1) return (-1);
 
-      if (mpz_cmp (total_ks_pos, total_ks_cnt) == 0) break;
+      gmp_fprintf (stderr, "Stopped, saved position %Zd to %s\n", restore.pos, restore_file);
+    }
+    else
+    {
+      remove (restore_file);
     }
   }
 
-  out_flush (out);
-
   /**
    * cleanup
    */
 
-  mpz_clear (iter_max);
-  mpz_clear (total_ks_cnt);
-  mpz_clear (total_ks_pos);
-  mpz_clear (total_ks_left);
+  for (int writers_idx = 0; writers_idx < out->writers_cnt; writers_idx++)
+  {
+    writer_t *writer = &out->writers_buf[writers_idx];
+
+    writer_finish (writer);
+
+    if (output_shards) fclose (writer->fp);
+  }
+
+  if (timings_on)
+  {
+    timings_mark (&timings, "generate");
+
+    timings_report (&timings, engine, 1);
+  }
+
+  if (out->manifest_fp)
+  {
+    out_manifest_line (out);
+
+    fclose (out->manifest_fp);
+  }
+
+  mpz_clear (out->manifest_beg);
+  mpz_clear (out->manifest_pos);
+
+  free (out->writers_buf);
+  free (out->shard_files);
+  free (shards_buf);
+
   mpz_clear (skip);
   mpz_clear (limit);
+
+  mpz_clear (restore.skip);
+  mpz_clear (restore.limit);
+  mpz_clear (restore.pos);
   mpz_clear (tmp);
+  mpz_clear (total_ks_out);
+  mpz_clear (ks_end);
 
-  for (int pw_len = pw_min; pw_len <= pw_max; pw_len++)
-  {
-    db_entry_t *db_entry = &db_entries[pw_len];
+  engine_free (engine);
 
-    if (db_entry->chains_buf)
-    {
-      int      chains_cnt = db_entry->chains_cnt;
-      chain_t *chains_buf = db_entry->chains_buf;
+  if (db_cache_buf)
+  {
+    #ifdef WINDOWS
+    free (db_cache_buf);
+    #else
+    munmap (db_cache_buf, db_cache_len);
+    #endif
+  }
 
-      for (int chains_idx = 0; chains_idx < chains_cnt; chains_idx++)
-      {
-        chain_t *chain_buf = &chains_buf[chains_idx];
+  if (rules)
+  {
+    rules_free (rules);
 
-        mpz_clear (chain_buf->ks_cnt);
-        mpz_clear (chain_buf->ks_pos);
-      }
+    free (rules);
+  }
 
-      free (db_entry->chains_buf);
-    }
+  free (engine);
 
-    if (db_entry->elems_buf)  free (db_entry->elems_buf);
+  for (int spares_idx = 0; spares_idx < out->spares_cnt; spares_idx++)
+  {
+    free (out->spares_buf[spares_idx]);
   }
 
+  free (out->spares_buf);
+  free (out->spares_tickets);
+  free (out->buf);
+
   free (out);
-  free (wordlen_dist);
-  free (pw_orders);
-  free (db_entries);
+
+  if (restore_stop) return (-1);
 
   return 0;
 }
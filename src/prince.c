@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define __USE_MINGW_ANSI_STDIO 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "engine.h"
+#include "prince.h"
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: libprince, the PRINCE generator as a library
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+struct prince_ctx
+{
+  engine_t engine;
+
+  mpz_t    seek_pos;
+
+};
+
+PRINCE_API void prince_opts_init (prince_opts_t *opts)
+{
+  opts->pw_min       = PW_MIN;
+  opts->pw_max       = PW_MAX;
+  opts->elem_cnt_min = ELEM_CNT_MIN;
+  opts->elem_cnt_max = ELEM_CNT_MAX;
+  opts->wl_dist_len  = 0;
+  opts->dedup_input  = 0;
+  opts->weighted     = 0;
+  opts->require      = 0;
+  opts->threads      = 1;
+}
+
+static int opts_check (const prince_opts_t *opts)
+{
+  // same rules as the pp command line
+
+  if (opts->pw_min       < IN_LEN_MIN)         return -1;
+  if (opts->pw_max       > OUT_LEN_MAX)        return -1;
+  if (opts->pw_min       > opts->pw_max)       return -1;
+  if (opts->elem_cnt_min < 1)                  return -1;
+  if (opts->elem_cnt_max > CHAIN_ELEMS_MAX)    return -1;
+  if (opts->elem_cnt_min > opts->elem_cnt_max) return -1;
+  if (opts->elem_cnt_max > opts->pw_max)       return -1;
+  if (opts->threads      < 1)                  return -1;
+  if (opts->threads      > THREADS_MAX)        return -1;
+  if (opts->require      & ~(CLASS_MASKS - 1)) return -1;
+
+  return 0;
+}
+
+PRINCE_API prince_ctx_t *prince_create (const char *wordlist, const size_t wordlist_len, const prince_opts_t *opts)
+{
+  if (opts_check (opts) == -1) return NULL;
+
+  prince_ctx_t *ctx = (prince_ctx_t *) malloc (sizeof (prince_ctx_t));
+
+  if (ctx == NULL) return NULL;
+
+  engine_t *engine = &ctx->engine;
+
+  engine_init (engine, opts->pw_min, opts->pw_max, opts->elem_cnt_min, opts->elem_cnt_max, opts->wl_dist_len, opts->weighted, opts->require);
+
+  if (wordlist_len) wl_load_buf (wordlist, wordlist_len, engine->db_entries, opts->threads, opts->weighted);
+
+  if (opts->dedup_input)
+  {
+    u64 elems_raw_cnts[IN_LEN_MAX + 1][CLASS_MASKS];
+
+    engine_dedup (engine, elems_raw_cnts);
+  }
+
+  engine_keyspace (engine);
+  engine_chains   (engine);
+
+  mpz_init (ctx->seek_pos);
+
+  return ctx;
+}
+
+PRINCE_API void prince_destroy (prince_ctx_t *ctx)
+{
+  if (ctx == NULL) return;
+
+  engine_free (&ctx->engine);
+
+  mpz_clear (ctx->seek_pos);
+
+  free (ctx);
+}
+
+PRINCE_API void prince_keyspace (prince_ctx_t *ctx, mpz_t ks_cnt)
+{
+  mpz_set (ks_cnt, ctx->engine.total_ks_cnt);
+}
+
+PRINCE_API void prince_tell (prince_ctx_t *ctx, mpz_t ks_pos)
+{
+  engine_pos_get (&ctx->engine, ks_pos);
+}
+
+PRINCE_API int prince_seek (prince_ctx_t *ctx, const mpz_t ks_pos)
+{
+  engine_t *engine = &ctx->engine;
+
+  if (mpz_sgn (ks_pos) < 0) return -1;
+
+  if (mpz_cmp (ks_pos, engine->total_ks_cnt) > 0) return -1;
+
+  engine_seek (engine, ks_pos);
+
+  return 0;
+}
+
+PRINCE_API int prince_seek_u128 (prince_ctx_t *ctx, const uint64_t ks_pos_hi, const uint64_t ks_pos_lo)
+{
+  const uint64_t words[2] = { ks_pos_lo, ks_pos_hi };
+
+  mpz_import (ctx->seek_pos, 2, -1, sizeof (uint64_t), 0, 0, words);
+
+  return prince_seek (ctx, ctx->seek_pos);
+}
+
+PRINCE_API size_t prince_next_batch (prince_ctx_t *ctx, char *buf, const size_t buf_size, uint32_t *offs, const size_t offs_cnt)
+{
+  engine_t *engine = &ctx->engine;
+
+  const db_entry_t *db_entries = engine->db_entries;
+
+  // the offsets are 32 bit and one of them is the end
+
+  const u64 size = MIN (buf_size, (size_t) UINT32_MAX);
+
+  if (offs_cnt < 2) return 0;
+
+  const u64 outs_max = offs_cnt - 1;
+
+  u64 outs_cnt = 0;
+
+  u64 len = 0;
+
+  offs[0] = 0;
+
+  while (outs_cnt < outs_max)
+  {
+    const int pw_len = engine_peek (engine);
+
+    if (pw_len == 0) break;
+
+    const int out_len = pw_len + 1;
+
+    // chain_emit () writes up to OUT_SLACK bytes past the last candidate, if there is no room for
+    // that the last candidate goes through pw_out
+
+    const u64 room = size - len;
+
+    u64 iter_lim = (room > OUT_SLACK) ? (room - OUT_SLACK) / out_len : 0;
+
+    const int direct = (iter_lim > 0);
+
+    if (direct == 0)
+    {
+      if (room < (u64) out_len) break;
+
+      iter_lim = 1;
+    }
+
+    iter_lim = MIN (iter_lim, outs_max - outs_cnt);
+
+    seg_t seg;
+
+    engine_next (engine, &seg, iter_lim);
+
+    char pw_buf[OUT_SLACK] = { 0 };
+
+    pw_buf[pw_len] = '\n';
+
+    chain_set_pwbuf_init (&seg.chain_buf, db_entries, seg.cur_chain_ks_poses, pw_buf);
+
+    if (direct)
+    {
+      chain_emit (&seg.chain_buf, db_entries, seg.cur_chain_ks_poses, pw_buf, 0, out_len, seg.iter_cnt, buf + len);
+    }
+    else
+    {
+      char pw_out[OUT_SLACK + PW_BUF_SIZE];
+
+      chain_emit (&seg.chain_buf, db_entries, seg.cur_chain_ks_poses, pw_buf, 0, out_len, 1, pw_out);
+
+      memcpy (buf + len, pw_out, out_len);
+    }
+
+    for (u64 iter_pos = 0; iter_pos < seg.iter_cnt; iter_pos++)
+    {
+      len += out_len;
+
+      offs[++outs_cnt] = (uint32_t) len;
+    }
+  }
+
+  return outs_cnt;
+}
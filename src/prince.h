@@ -0,0 +1,82 @@
+#ifndef PRINCE_H
+#define PRINCE_H
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: libprince, the PRINCE generator as a library
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#if defined (__GNUC__) && !defined (_WIN32)
+#define PRINCE_API __attribute__ ((visibility ("default")))
+#else
+#define PRINCE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Usage: fill a prince_opts_t with prince_opts_init () and change what pp
+ * would get on the command line, create a context from the wordlist in
+ * memory, optionally seek, then call prince_next_batch () until it returns 0.
+ * The candidates come out in the same order as from pp. A context must not be
+ * used by two threads at the same time.
+ */
+
+typedef struct prince_ctx prince_ctx_t;
+
+#define PRINCE_CLASS_LOWER    1
+#define PRINCE_CLASS_UPPER    2
+#define PRINCE_CLASS_DIGIT    4
+#define PRINCE_CLASS_SPECIAL  8
+
+typedef struct
+{
+  int pw_min;         // --pw-min
+  int pw_max;         // --pw-max
+  int elem_cnt_min;   // --elem-cnt-min
+  int elem_cnt_max;   // --elem-cnt-max
+  int wl_dist_len;    // --wl-dist-len
+  int dedup_input;    // --dedup-input
+  int weighted;       // --weighted
+  int require;        // --require, PRINCE_CLASS_* or'ed together
+  int threads;        // threads used to load the wordlist
+
+} prince_opts_t;
+
+PRINCE_API void prince_opts_init (prince_opts_t *opts);
+
+// wordlist is newline separated like the input of pp and is not referenced after the call,
+// returns NULL if the options are invalid
+
+PRINCE_API prince_ctx_t *prince_create  (const char *wordlist, const size_t wordlist_len, const prince_opts_t *opts);
+PRINCE_API void          prince_destroy (prince_ctx_t *ctx);
+
+PRINCE_API void prince_keyspace  (prince_ctx_t *ctx, mpz_t ks_cnt);
+PRINCE_API void prince_tell      (prince_ctx_t *ctx, mpz_t ks_pos);
+
+// both return -1 if the position is beyond the keyspace
+
+PRINCE_API int  prince_seek      (prince_ctx_t *ctx, const mpz_t ks_pos);
+PRINCE_API int  prince_seek_u128 (prince_ctx_t *ctx, const uint64_t ks_pos_hi, const uint64_t ks_pos_lo);
+
+// writes as many candidates as fit into buf, each terminated by a newline, and returns their
+// number n. Candidate i starts at buf + offs[i] and offs[n] is the end of the last one, so offs
+// needs room for n + 1 entries. Returns 0 at the end of the keyspace or if buf can not take the
+// next candidate, which is at most 65 bytes long.
+
+PRINCE_API size_t prince_next_batch (prince_ctx_t *ctx, char *buf, const size_t buf_size, uint32_t *offs, const size_t offs_cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PRINCE_H
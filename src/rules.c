@@ -0,0 +1,678 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#define __USE_MINGW_ANSI_STDIO 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rules.h"
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: hashcat rule engine for --rules
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+/**
+ * The operations and their edge cases follow the hashcat CPU rule engine.
+ * An operation that would make the word longer than RULE_BUF_SIZE - 1 leaves
+ * it unchanged, so every rule has exactly one result and the keyspace is the
+ * number of candidates times the number of rules. Rejection and memory rules
+ * are not supported, the lines with them are skipped.
+ */
+
+#define ALLOC_NEW_RULES 0x400
+
+static int rule_pos (const u8 c)
+{
+  if ((c >= '0') && (c <= '9')) return c - '0';
+  if ((c >= 'A') && (c <= 'Z')) return c - 'A' + 10;
+
+  return -1;
+}
+
+static int rule_parse (const char *line_buf, const int line_len, rule_t *rule)
+{
+  // the parameter types of each operation: N is a position, X a character
+
+  memset (rule, 0, sizeof (rule_t));
+
+  int pos = 0;
+
+  while (pos < line_len)
+  {
+    const u8 op = line_buf[pos++];
+
+    if (op == ' ') continue;
+
+    if (rule->ops_cnt == RULE_OPS_MAX) return -1;
+
+    const char *params = NULL;
+
+    switch (op)
+    {
+      case ':': case 'l': case 'u': case 'c': case 'C': case 't': case 'r': case 'd':
+      case 'f': case '{': case '}': case '[': case ']': case 'q': case 'E': case 'k':
+      case 'K':
+        params = "";   break;
+
+      case 'T': case 'p': case 'D': case '\'': case 'z': case 'Z': case 'L': case 'R':
+      case '+': case '-': case '.': case ',': case 'y': case 'Y':
+        params = "N";  break;
+
+      case '$': case '^': case '@': case 'e':
+        params = "X";  break;
+
+      case 'x': case 'O': case '*':
+        params = "NN"; break;
+
+      case 'i': case 'o':
+        params = "NX"; break;
+
+      case 's':
+        params = "XX"; break;
+
+      default:
+        return -1;
+    }
+
+    rule_op_t *rule_op = &rule->ops_buf[rule->ops_cnt++];
+
+    rule_op->op = op;
+
+    for (int idx = 0; params[idx]; idx++)
+    {
+      if (pos == line_len) return -1;
+
+      const u8 c = line_buf[pos++];
+
+      int val = c;
+
+      if (params[idx] == 'N')
+      {
+        val = rule_pos (c);
+
+        if (val == -1) return -1;
+      }
+
+      if (idx == 0) rule_op->p0 = val;
+      else          rule_op->p1 = val;
+    }
+  }
+
+  if (rule->ops_cnt == 0) return -1;
+
+  // an optional case operation followed by appends and prepends makes an affix rule
+
+  rule->kind = RULE_KIND_AFFIX;
+
+  for (int ops_idx = 0; ops_idx < rule->ops_cnt; ops_idx++)
+  {
+    const rule_op_t *rule_op = &rule->ops_buf[ops_idx];
+
+    switch (rule_op->op)
+    {
+      case ':':
+        break;
+
+      case 'l': case 'u': case 'c': case 'C': case 't':
+        if ((rule->case_op == 0) && (rule->pre_len == 0) && (rule->suf_len == 0))
+        {
+          rule->case_op = rule_op->op;
+        }
+        else
+        {
+          rule->kind = RULE_KIND_GENERIC;
+        }
+        break;
+
+      case '$':
+        rule->suf_buf[rule->suf_len++] = rule_op->p0;
+        break;
+
+      case '^':
+        memmove (rule->pre_buf + 1, rule->pre_buf, rule->pre_len);
+
+        rule->pre_buf[0] = rule_op->p0;
+
+        rule->pre_len++;
+        break;
+
+      default:
+        rule->kind = RULE_KIND_GENERIC;
+        break;
+    }
+  }
+
+  return 0;
+}
+
+static int rule_len_max (const rule_t *rule, int len)
+{
+  // the result length only depends on the input length, except for purge
+
+  for (int ops_idx = 0; ops_idx < rule->ops_cnt; ops_idx++)
+  {
+    const rule_op_t *rule_op = &rule->ops_buf[ops_idx];
+
+    const int p0 = rule_op->p0;
+    const int p1 = rule_op->p1;
+
+    switch (rule_op->op)
+    {
+      case 'd':
+      case 'f':
+      case 'q':  if ((len * 2) < RULE_BUF_SIZE)                 len *= 2;          break;
+      case 'p':  if ((len * (p0 + 1)) < RULE_BUF_SIZE)          len *= p0 + 1;     break;
+      case '$':
+      case '^':  if ((len + 1) < RULE_BUF_SIZE)                 len += 1;          break;
+      case 'i':  if ((p0 <= len) && ((len + 1) < RULE_BUF_SIZE)) len += 1;         break;
+      case '[':
+      case ']':  if (len > 0)                                   len -= 1;          break;
+      case 'D':  if (p0 < len)                                  len -= 1;          break;
+      case 'x':  if ((p0 < len) && ((p0 + p1) <= len))          len  = p1;         break;
+      case 'O':  if ((p0 < len) && ((p0 + p1) <= len))          len -= p1;         break;
+      case '\'': if (p0 < len)                                  len  = p0;         break;
+      case 'z':
+      case 'Z':  if ((len > 0) && ((len + p0) < RULE_BUF_SIZE)) len += p0;         break;
+      case 'y':
+      case 'Y':  if ((p0 <= len) && ((len + p0) < RULE_BUF_SIZE)) len += p0;       break;
+      case '@':  return RULE_BUF_SIZE - 1;
+    }
+  }
+
+  return len;
+}
+
+static u64 rules_fingerprint (u64 fingerprint, const char *line_buf, const int line_len)
+{
+  for (int idx = 0; idx < line_len; idx++)
+  {
+    fingerprint = (fingerprint ^ (u8) line_buf[idx]) * 0x100000001b3ULL;
+  }
+
+  return (fingerprint ^ '\n') * 0x100000001b3ULL;
+}
+
+int rules_load (const char *rules_file, rules_t *rules)
+{
+  FILE *fp = fopen (rules_file, "rb");
+
+  if (fp == NULL)
+  {
+    fprintf (stderr, "%s: %s\n", rules_file, strerror (errno));
+
+    return (-1);
+  }
+
+  memset (rules, 0, sizeof (rules_t));
+
+  rules->fingerprint = 0xcbf29ce484222325ULL;
+
+  int rules_alloc = 0;
+
+  int line_num = 0;
+
+  char line_buf[BUFSIZ];
+
+  while (fgets (line_buf, sizeof (line_buf), fp))
+  {
+    line_num++;
+
+    int line_len = strlen (line_buf);
+
+    while (line_len && ((line_buf[line_len - 1] == '\n') || (line_buf[line_len - 1] == '\r'))) line_len--;
+
+    line_buf[line_len] = 0;
+
+    if (line_len == 0) continue;
+
+    if (line_buf[0] == '#') continue;
+
+    if (rules->rules_cnt == rules_alloc)
+    {
+      rules_alloc += ALLOC_NEW_RULES;
+
+      rules->rules_buf = (rule_t *) realloc (rules->rules_buf, rules_alloc * sizeof (rule_t));
+
+      if (rules->rules_buf == NULL)
+      {
+        fprintf (stderr, "Out of memory trying to allocate %zu bytes!\n", (size_t) rules_alloc * sizeof (rule_t));
+
+        exit (-1);
+      }
+    }
+
+    if (rule_parse (line_buf, line_len, &rules->rules_buf[rules->rules_cnt]) == -1)
+    {
+      fprintf (stderr, "%s: Skipping unsupported rule in line %d: %s\n", rules_file, line_num, line_buf);
+
+      continue;
+    }
+
+    rules->fingerprint = rules_fingerprint (rules->fingerprint, line_buf, line_len);
+
+    rules->rules_cnt++;
+  }
+
+  fclose (fp);
+
+  if (rules->rules_cnt == 0)
+  {
+    fprintf (stderr, "%s: No usable rules\n", rules_file);
+
+    free (rules->rules_buf);
+
+    return (-1);
+  }
+
+  for (int pw_len = 1; pw_len <= OUT_LEN_MAX; pw_len++)
+  {
+    u64 rec_max = 0;
+
+    for (int rules_idx = 0; rules_idx < rules->rules_cnt; rules_idx++)
+    {
+      rec_max += rule_len_max (&rules->rules_buf[rules_idx], pw_len) + 1;
+    }
+
+    rules->rec_max[pw_len] = rec_max;
+
+    rules->rec_max_all = MAX (rules->rec_max_all, rec_max);
+  }
+
+  return 0;
+}
+
+void rules_free (rules_t *rules)
+{
+  free (rules->rules_buf);
+
+  rules->rules_buf = NULL;
+  rules->rules_cnt = 0;
+}
+
+/**
+ * Case conversion of 8 bytes at once: a byte gets 0x20 in the mask if it is
+ * in the range, the high bit of each byte is masked out before adding so
+ * nothing carries into the next byte.
+ */
+
+#define SWAR_HI 0x8080808080808080ULL
+
+static inline u64 swar_range_mask (const u64 x, const u64 add_lo, const u64 add_hi)
+{
+  const u64 t = x & ~SWAR_HI;
+
+  return (((t + add_lo) & ~(t + add_hi) & ~x) & SWAR_HI) >> 2;
+}
+
+static inline u64 swar_upper_mask (const u64 x)
+{
+  // 'A' = 0x41 reaches 0x80 with 0x3f, 'Z' + 1 = 0x5b with 0x25
+
+  return swar_range_mask (x, 0x3f3f3f3f3f3f3f3fULL, 0x2525252525252525ULL);
+}
+
+static inline u64 swar_lower_mask (const u64 x)
+{
+  // 'a' = 0x61 reaches 0x80 with 0x1f, 'z' + 1 = 0x7b with 0x05
+
+  return swar_range_mask (x, 0x1f1f1f1f1f1f1f1fULL, 0x0505050505050505ULL);
+}
+
+static void case_apply (u8 *buf, const int len, const u8 case_op)
+{
+  // buf is a multiple of 8 bytes behind len
+
+  for (int off = 0; off < len; off += 8)
+  {
+    u64 x;
+
+    memcpy (&x, buf + off, 8);
+
+    switch (case_op)
+    {
+      case 'l': x ^= swar_upper_mask (x);                        break;
+      case 'c': x ^= swar_upper_mask (x);                        break;
+      case 'u': x ^= swar_lower_mask (x);                        break;
+      case 'C': x ^= swar_lower_mask (x);                        break;
+      case 't': x ^= swar_upper_mask (x) | swar_lower_mask (x); break;
+    }
+
+    memcpy (buf + off, &x, 8);
+  }
+
+  if (len == 0) return;
+
+  if ((case_op == 'c') && (buf[0] >= 'a') && (buf[0] <= 'z')) buf[0] ^= 0x20;
+  if ((case_op == 'C') && (buf[0] >= 'A') && (buf[0] <= 'Z')) buf[0] ^= 0x20;
+}
+
+static inline u8 char_lower (const u8 c)
+{
+  return ((c >= 'A') && (c <= 'Z')) ? c ^ 0x20 : c;
+}
+
+static inline u8 char_upper (const u8 c)
+{
+  return ((c >= 'a') && (c <= 'z')) ? c ^ 0x20 : c;
+}
+
+static inline u8 char_toggle (const u8 c)
+{
+  return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))) ? c ^ 0x20 : c;
+}
+
+int rule_apply (const rule_t *rule, const char *in_buf, const int in_len, char *out_buf)
+{
+  // out_buf needs RULE_BUF_SIZE bytes
+
+  u8 *buf = (u8 *) out_buf;
+
+  int len = MIN (in_len, RULE_BUF_SIZE - 1);
+
+  memcpy (buf, in_buf, len);
+
+  for (int ops_idx = 0; ops_idx < rule->ops_cnt; ops_idx++)
+  {
+    const rule_op_t *rule_op = &rule->ops_buf[ops_idx];
+
+    const int p0 = rule_op->p0;
+    const int p1 = rule_op->p1;
+
+    u8 c;
+
+    switch (rule_op->op)
+    {
+      case 'l':
+        for (int i = 0; i < len; i++) buf[i] = char_lower (buf[i]);
+        break;
+
+      case 'u':
+        for (int i = 0; i < len; i++) buf[i] = char_upper (buf[i]);
+        break;
+
+      case 'c':
+        for (int i = 0; i < len; i++) buf[i] = char_lower (buf[i]);
+        if (len) buf[0] = char_upper (buf[0]);
+        break;
+
+      case 'C':
+        for (int i = 0; i < len; i++) buf[i] = char_upper (buf[i]);
+        if (len) buf[0] = char_lower (buf[0]);
+        break;
+
+      case 't':
+        for (int i = 0; i < len; i++) buf[i] = char_toggle (buf[i]);
+        break;
+
+      case 'T':
+        if (p0 < len) buf[p0] = char_toggle (buf[p0]);
+        break;
+
+      case 'E':
+      case 'e':
+        c = (rule_op->op == 'E') ? ' ' : p0;
+        for (int i = 0; i < len; i++) buf[i] = char_lower (buf[i]);
+        for (int i = 0; i < len; i++) if ((i == 0) || (buf[i - 1] == c)) buf[i] = char_upper (buf[i]);
+        break;
+
+      case 'r':
+        for (int l = 0, r = len - 1; l < r; l++, r--)
+        {
+          c = buf[l]; buf[l] = buf[r]; buf[r] = c;
+        }
+        break;
+
+      case 'd':
+        if ((len * 2) >= RULE_BUF_SIZE) break;
+        memcpy (buf + len, buf, len);
+        len *= 2;
+        break;
+
+      case 'p':
+        if ((len * (p0 + 1)) >= RULE_BUF_SIZE) break;
+        for (int i = 1; i <= p0; i++) memcpy (buf + len * i, buf, len);
+        len *= p0 + 1;
+        break;
+
+      case 'f':
+        if ((len * 2) >= RULE_BUF_SIZE) break;
+        for (int i = 0; i < len; i++) buf[len + i] = buf[len - 1 - i];
+        len *= 2;
+        break;
+
+      case 'q':
+        if ((len * 2) >= RULE_BUF_SIZE) break;
+        for (int i = len - 1; i >= 0; i--) buf[i * 2] = buf[i * 2 + 1] = buf[i];
+        len *= 2;
+        break;
+
+      case '{':
+        if (len < 2) break;
+        c = buf[0];
+        memmove (buf, buf + 1, len - 1);
+        buf[len - 1] = c;
+        break;
+
+      case '}':
+        if (len < 2) break;
+        c = buf[len - 1];
+        memmove (buf + 1, buf, len - 1);
+        buf[0] = c;
+        break;
+
+      case '$':
+        if ((len + 1) >= RULE_BUF_SIZE) break;
+        buf[len++] = p0;
+        break;
+
+      case '^':
+        if ((len + 1) >= RULE_BUF_SIZE) break;
+        memmove (buf + 1, buf, len);
+        buf[0] = p0;
+        len++;
+        break;
+
+      case '[':
+        if (len == 0) break;
+        memmove (buf, buf + 1, len - 1);
+        len--;
+        break;
+
+      case ']':
+        if (len == 0) break;
+        len--;
+        break;
+
+      case 'D':
+        if (p0 >= len) break;
+        memmove (buf + p0, buf + p0 + 1, len - p0 - 1);
+        len--;
+        break;
+
+      case 'x':
+        if ((p0 >= len) || ((p0 + p1) > len)) break;
+        memmove (buf, buf + p0, p1);
+        len = p1;
+        break;
+
+      case 'O':
+        if ((p0 >= len) || ((p0 + p1) > len)) break;
+        memmove (buf + p0, buf + p0 + p1, len - p0 - p1);
+        len -= p1;
+        break;
+
+      case 'i':
+        if ((p0 > len) || ((len + 1) >= RULE_BUF_SIZE)) break;
+        memmove (buf + p0 + 1, buf + p0, len - p0);
+        buf[p0] = p1;
+        len++;
+        break;
+
+      case 'o':
+        if (p0 < len) buf[p0] = p1;
+        break;
+
+      case '\'':
+        if (p0 < len) len = p0;
+        break;
+
+      case 's':
+        for (int i = 0; i < len; i++) if (buf[i] == p0) buf[i] = p1;
+        break;
+
+      case '@':
+      {
+        int n = 0;
+        for (int i = 0; i < len; i++) if (buf[i] != p0) buf[n++] = buf[i];
+        len = n;
+        break;
+      }
+
+      case 'z':
+        if ((len == 0) || ((len + p0) >= RULE_BUF_SIZE)) break;
+        memmove (buf + p0, buf, len);
+        memset (buf, buf[p0], p0);
+        len += p0;
+        break;
+
+      case 'Z':
+        if ((len == 0) || ((len + p0) >= RULE_BUF_SIZE)) break;
+        memset (buf + len, buf[len - 1], p0);
+        len += p0;
+        break;
+
+      case 'y':
+        if ((p0 > len) || ((len + p0) >= RULE_BUF_SIZE)) break;
+        memmove (buf + p0, buf, len);
+        len += p0;
+        break;
+
+      case 'Y':
+        if ((p0 > len) || ((len + p0) >= RULE_BUF_SIZE)) break;
+        memcpy (buf + len, buf + len - p0, p0);
+        len += p0;
+        break;
+
+      case 'k':
+        if (len < 2) break;
+        c = buf[0]; buf[0] = buf[1]; buf[1] = c;
+        break;
+
+      case 'K':
+        if (len < 2) break;
+        c = buf[len - 1]; buf[len - 1] = buf[len - 2]; buf[len - 2] = c;
+        break;
+
+      case '*':
+        if ((p0 >= len) || (p1 >= len)) break;
+        c = buf[p0]; buf[p0] = buf[p1]; buf[p1] = c;
+        break;
+
+      case 'L':
+        if (p0 < len) buf[p0] <<= 1;
+        break;
+
+      case 'R':
+        if (p0 < len) buf[p0] >>= 1;
+        break;
+
+      case '+':
+        if (p0 < len) buf[p0]++;
+        break;
+
+      case '-':
+        if (p0 < len) buf[p0]--;
+        break;
+
+      case '.':
+        if ((p0 + 1) < len) buf[p0] = buf[p0 + 1];
+        break;
+
+      case ',':
+        if ((p0 > 0) && (p0 < len)) buf[p0] = buf[p0 - 1];
+        break;
+    }
+  }
+
+  return len;
+}
+
+/**
+ * All rules for one candidate, from rule_beg to rule_end. The records are the
+ * result and a newline, or a length byte and the result.
+ * The case variants for the affix rules are made once per candidate.
+ */
+
+u64 rules_emit (const rules_t *rules, const int len_prefix, const char *pw_buf, const int pw_len, const int rule_beg, const int rule_end, char *out_buf)
+{
+  u8 case_bufs[6][OUT_LEN_MAX + 8];
+
+  int case_done[6] = { 0 };
+
+  const char *case_ops = ":lucCt";
+
+  char *dst = out_buf;
+
+  for (int rules_idx = rule_beg; rules_idx < rule_end; rules_idx++)
+  {
+    const rule_t *rule = &rules->rules_buf[rules_idx];
+
+    int out_len;
+
+    if (rule->kind == RULE_KIND_AFFIX)
+    {
+      const int case_idx = (rule->case_op) ? (int) (strchr (case_ops, rule->case_op) - case_ops) : 0;
+
+      u8 *case_buf = case_bufs[case_idx];
+
+      if (case_done[case_idx] == 0)
+      {
+        memset (case_buf, 0, sizeof (case_bufs[0]));
+
+        memcpy (case_buf, pw_buf, pw_len);
+
+        if (case_idx) case_apply (case_buf, pw_len, rule->case_op);
+
+        case_done[case_idx] = 1;
+      }
+
+      out_len = rule->pre_len + pw_len + rule->suf_len;
+
+      char *out = dst + len_prefix;
+
+      memcpy (out,                           rule->pre_buf, rule->pre_len);
+      memcpy (out + rule->pre_len,           case_buf,      pw_len);
+      memcpy (out + rule->pre_len + pw_len,  rule->suf_buf, rule->suf_len);
+    }
+    else
+    {
+      char rule_buf[RULE_BUF_SIZE];
+
+      out_len = rule_apply (rule, pw_buf, pw_len, rule_buf);
+
+      memcpy (dst + len_prefix, rule_buf, out_len);
+    }
+
+    if (len_prefix)
+    {
+      dst[0] = (char) out_len;
+
+      dst += 1 + out_len;
+    }
+    else
+    {
+      dst[out_len] = '\n';
+
+      dst += out_len + 1;
+    }
+  }
+
+  return dst - out_buf;
+}
@@ -0,0 +1,70 @@
+#ifndef RULES_H
+#define RULES_H
+
+/**
+ * Name........: princeprocessor (pp)
+ * Description.: hashcat rule engine for --rules
+ * Version.....: 0.20
+ * Autor.......: Jens Steube <jens.steube@gmail.com>
+ * License.....: MIT
+ */
+
+#include "engine.h"
+
+#define RULE_BUF_SIZE  256
+#define RULE_OPS_MAX   32
+
+#define RULE_KIND_GENERIC  0
+#define RULE_KIND_AFFIX    1
+
+typedef struct
+{
+  u8  op;
+  u8  p0;
+  u8  p1;
+
+} rule_op_t;
+
+/**
+ * A rule made of at most one case operation followed by appends and prepends
+ * is an affix rule, its result is pre_buf + case (word) + suf_buf. These take
+ * the batch path, everything else goes through the interpreter.
+ */
+
+typedef struct
+{
+  rule_op_t  ops_buf[RULE_OPS_MAX];
+  int        ops_cnt;
+
+  int        kind;
+  u8         case_op;
+
+  u8         pre_buf[RULE_OPS_MAX];
+  int        pre_len;
+  u8         suf_buf[RULE_OPS_MAX];
+  int        suf_len;
+
+} rule_t;
+
+typedef struct
+{
+  rule_t    *rules_buf;
+  int        rules_cnt;
+
+  u64        fingerprint;
+
+  // upper bound of the output bytes of all rules for one candidate of a length
+
+  u64        rec_max[OUT_LEN_MAX + 1];
+  u64        rec_max_all;
+
+} rules_t;
+
+int  rules_load (const char *rules_file, rules_t *rules);
+void rules_free (rules_t *rules);
+
+int  rule_apply (const rule_t *rule, const char *in_buf, const int in_len, char *out_buf);
+
+u64  rules_emit (const rules_t *rules, const int len_prefix, const char *pw_buf, const int pw_len, const int rule_beg, const int rule_end, char *out_buf);
+
+#endif // RULES_H
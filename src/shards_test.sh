@@ -0,0 +1,79 @@
+#!/bin/sh
+
+##
+## make test-shards, runs pp64.bin with --output-shards on a file and on a FIFO whose reader
+## takes about 3 MB/s, once single-threaded and once with threads. The file has to get most
+## of the output, and the shards put back together in --manifest order have to give the
+## output of a plain run
+##
+
+PP=${1:-./pp64.bin}
+
+LIMIT=10000000
+SHARE_MIN=90
+
+DIR=$(mktemp -d /tmp/pp-shards.XXXXXX) || exit 1
+
+trap 'rm -rf "$DIR"' EXIT
+
+seq 1 2000 > "$DIR/words"
+
+"$PP" --limit=$LIMIT < "$DIR/words" > "$DIR/plain.out" || exit 1
+
+mkfifo "$DIR/slow.fifo" || exit 1
+
+for threads in 1 4
+do
+  rm -f "$DIR/fast.out" "$DIR/slow.out" "$DIR/manifest"
+
+  # 64 KB every 20 ms until the writer closes the FIFO
+
+  (
+    while :
+    do
+      n=$(dd bs=65536 count=1 2> /dev/null | tee -a "$DIR/slow.out" | wc -c)
+
+      [ "$n" -eq 0 ] && break
+
+      sleep 0.02
+    done
+  ) < "$DIR/slow.fifo" &
+
+  "$PP" --threads=$threads --limit=$LIMIT --output-shards="$DIR/fast.out,$DIR/slow.fifo" --manifest="$DIR/manifest" < "$DIR/words" || exit 1
+
+  wait
+
+  fast=$(wc -c < "$DIR/fast.out")
+  slow=$(wc -c < "$DIR/slow.out")
+
+  share=$((fast * 100 / (fast + slow)))
+
+  echo "--threads=$threads: fast file $fast bytes, slow FIFO $slow bytes, $share% to the file"
+
+  if [ "$share" -lt $SHARE_MIN ]
+  then
+    echo "FAIL: the file got less than $SHARE_MIN% of the output"
+
+    exit 1
+  fi
+
+  # a manifest line is a range of positions and the shard that got it
+
+  sed "s|$DIR/slow.fifo|$DIR/slow.out|" "$DIR/manifest" > "$DIR/manifest.out"
+
+  if ! awk '{ for (pos = $1; pos < $2; pos++) { if ((getline line < $3) <= 0) exit 1; print line } }' "$DIR/manifest.out" > "$DIR/joined.out"
+  then
+    echo "FAIL: the manifest names more output than the shards hold"
+
+    exit 1
+  fi
+
+  if ! cmp -s "$DIR/joined.out" "$DIR/plain.out"
+  then
+    echo "FAIL: the shards in manifest order differ from the plain output"
+
+    exit 1
+  fi
+done
+
+echo "ok"